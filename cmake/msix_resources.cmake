@@ -117,6 +117,7 @@ set(RESOURCE_HEADER "//
 // 
 //  This file is generated by CMake. Do not edit.
 //
+#pragma once
 #include \"AppxPackaging.hpp\"
 #include \"ComHelper.hpp\"
 #include \"AppxFactory.hpp\"
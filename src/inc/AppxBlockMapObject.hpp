@@ -8,6 +8,7 @@
 #include <map>
 #include <vector>
 #include <iterator>
+#include <mutex>
 
 #include "StreamBase.hpp"
 #include "VerifierObject.hpp"
@@ -32,7 +33,7 @@ class IAppxBlockMapInternal : public IUnknown
 {
 public:
     virtual std::vector<std::string>  GetFileNames() = 0;
-    virtual std::vector<MSIX::Block>  GetBlocks(const std::string& fileName) = 0;
+    virtual MSIX::BlockSpan           GetBlocks(const std::string& fileName) = 0;
     virtual MSIX::ComPtr<IAppxBlockMapFile> GetFile(const std::string& fileName) = 0;
 };
 SpecializeUuidOfImpl(IAppxBlockMapInternal);
@@ -42,7 +43,7 @@ namespace MSIX {
     class AppxBlockMapBlock final : public MSIX::ComClass<AppxBlockMapBlock, IAppxBlockMapBlock>
     {
     public:
-        AppxBlockMapBlock(IMsixFactory* factory, Block* block) :
+        AppxBlockMapBlock(IMsixFactory* factory, const Block* block) :
             m_factory(factory),
             m_block(block)
         {}
@@ -50,7 +51,8 @@ namespace MSIX {
         // IAppxBlockMapBlock
         HRESULT STDMETHODCALLTYPE GetHash(UINT32* bufferSize, BYTE** buffer) noexcept override try
         {
-            ThrowHrIfFailed(m_factory->MarshalOutBytes(m_block->hash, bufferSize, buffer));
+            std::vector<std::uint8_t> hash(m_block->hash.begin(), m_block->hash.end());
+            ThrowHrIfFailed(m_factory->MarshalOutBytes(hash, bufferSize, buffer));
             return static_cast<HRESULT>(Error::OK);
         } CATCH_RETURN();
 
@@ -63,7 +65,7 @@ namespace MSIX {
 
     private:
         IMsixFactory* m_factory;
-        Block*        m_block;
+        const Block*  m_block;
     };
 
     class AppxBlockMapFile final : public MSIX::ComClass<AppxBlockMapFile, IAppxBlockMapFile>
@@ -71,7 +73,7 @@ namespace MSIX {
     public:
         AppxBlockMapFile(
             IMsixFactory* factory,
-            std::vector<Block>* blocks,
+            const BlockSpan& blocks,
             std::uint32_t localFileHeaderSize,
             const std::string& name,
             std::uint64_t uncompressedSize
@@ -89,10 +91,10 @@ namespace MSIX {
         {
             ThrowErrorIf(Error::InvalidParameter, (blocks == nullptr || *blocks != nullptr), "bad pointer.");
             if (m_blockMapBlocks.empty())
-            {   m_blockMapBlocks.reserve(m_blocks->size());
+            {   m_blockMapBlocks.reserve(m_blocks.size());
                 std::transform(
-                    m_blocks->begin(),
-                    m_blocks->end(),
+                    m_blocks.begin(),
+                    m_blocks.end(),
                     std::back_inserter(m_blockMapBlocks),
                     [&](auto& item){
                         return ComPtr<IAppxBlockMapBlock>::Make<AppxBlockMapBlock>(m_factory, &item);
@@ -131,7 +133,7 @@ namespace MSIX {
 
     private:
         std::vector<ComPtr<IAppxBlockMapBlock>> m_blockMapBlocks;
-        std::vector<Block>* m_blocks;
+        BlockSpan           m_blocks;
         IMsixFactory*       m_factory;
         std::uint32_t       m_localFileHeaderSize;
         std::string         m_name;
@@ -158,12 +160,36 @@ namespace MSIX {
 
         // IAppxBlockMapInternal methods
         std::vector<std::string>        GetFileNames() override;
-        std::vector<Block>              GetBlocks(const std::string& fileName) override;
+        BlockSpan                       GetBlocks(const std::string& fileName) override;
         MSIX::ComPtr<IAppxBlockMapFile> GetFile(const std::string& fileName) override;
 
     protected:
-        std::map<std::string, std::vector<Block>>        m_blockMap;
-        std::map<std::string, ComPtr<IAppxBlockMapFile>> m_blockMapFiles;
+        // A File element of the blockmap. Its blocks are [firstBlock, firstBlock + blockCount) of m_blocks.
+        struct FileEntry
+        {
+            std::string               name;
+            std::size_t               firstBlock;
+            std::size_t               blockCount;
+            std::uint32_t             localFileHeaderSize;
+            std::uint64_t             uncompressedSize;
+            ComPtr<IAppxBlockMapFile> file; // created the first time it is asked for
+        };
+
+        // Fills the file and block tables as the blockmap is parsed, see IXmlFactory::ParseFromStream.
+        class ElementHandler;
+
+        // Add the File elements of the blockmap, and their Block elements, in blockmap order.
+        void StartFile(const ComPtr<IXmlElement>& fileNode);
+        void AddBlock(const ComPtr<IXmlElement>& blockNode);
+        void EndFile();
+
+        FileEntry* FindFile(const std::string& fileName);
+        ComPtr<IAppxBlockMapFile> GetFile(FileEntry& entry);
+        BlockSpan GetBlocks(const FileEntry& entry);
+
+        std::vector<Block>     m_blocks; // the blocks of every file, in blockmap order
+        std::vector<FileEntry> m_files;  // sorted by name
+        std::mutex             m_filesLock; // guards the lazy creation of FileEntry::file
         IMsixFactory*   m_factory;
         ComPtr<IStream> m_stream;
     };
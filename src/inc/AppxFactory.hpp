@@ -59,6 +59,11 @@ namespace MSIX {
             return m_xmlFactory->CreateDomFromStream(footPrintType, stream);
         }
 
+        bool ParseFromStream(XmlContentType footPrintType, const ComPtr<IStream>& stream, XmlElementHandler& handler) override
+        {
+            return m_xmlFactory->ParseFromStream(footPrintType, stream, handler);
+        }
+
         // IMsixFactoryOverrides
         HRESULT STDMETHODCALLTYPE SpecifyExtension(MSIX_FACTORY_EXTENSION name, IUnknown* extension) noexcept override;
         HRESULT STDMETHODCALLTYPE GetCurrentSpecifiedExtension(MSIX_FACTORY_EXTENSION name, IUnknown** extension) noexcept override;
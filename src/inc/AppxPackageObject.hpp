@@ -15,6 +15,7 @@
 #include "ComHelper.hpp"
 #include "StreamBase.hpp"
 #include "StorageObject.hpp"
+#include "DirectoryObject.hpp"
 #include "ZipObject.hpp"
 #include "VerifierObject.hpp"
 #include "IXml.hpp"
@@ -53,6 +54,14 @@ namespace MSIX {
         AppxPackageObject(IMsixFactory* factory, MSIX_VALIDATION_OPTION validation, MSIX_APPLICABILITY_OPTIONS applicabilityOptions, const ComPtr<IStorageObject>& container);
         ~AppxPackageObject() {}
 
+        // Unpacks a package from a stream that can't seek, e.g. a pipe, as it arrives. Payload files are written
+        // to a staging directory in the target as they are read, hashing their blocks on the way; once the
+        // footprint files at the end of the package are read and validated, the hashes are checked against the
+        // blockmap, the payload files are moved to their names and the footprint files are written. If that
+        // fails the staged files are deleted. Bundles and package subfolders aren't supported.
+        static void UnpackFromStream(IMsixFactory* factory, MSIX_VALIDATION_OPTION validation, MSIX_PACKUNPACK_OPTION options,
+            const ComPtr<IStream>& stream, const ComPtr<DirectoryObject>& to);
+
         HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** ppvObject) noexcept override
         {
             if (ppvObject == nullptr || *ppvObject != nullptr)
@@ -119,6 +128,7 @@ namespace MSIX {
         std::vector<std::string> GetFileNames(FileNameOptions options) override;
         ComPtr<IStream> GetFile(const std::string& fileName) override;
         ComPtr<IStream> OpenFile(const std::string& fileName, MSIX::FileStream::Mode mode) override;
+        void WillRead(const std::string& fileName) override { m_container->WillRead(fileName); }
         std::string GetFileName() override;
 
     protected:
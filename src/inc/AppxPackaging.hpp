@@ -1239,7 +1239,10 @@ typedef /* [v1_enum] */
 enum MSIX_PACKUNPACK_OPTION
     {
         MSIX_PACKUNPACK_OPTION_NONE                    = 0x0,
-        MSIX_PACKUNPACK_OPTION_CREATEPACKAGESUBFOLDER  = 0x1
+        MSIX_PACKUNPACK_OPTION_CREATEPACKAGESUBFOLDER  = 0x1,
+        MSIX_PACKUNPACK_OPTION_UNPACKINPARALLEL        = 0x2,
+        MSIX_PACKUNPACK_OPTION_UNBUFFEREDWRITES        = 0x4,
+        MSIX_PACKUNPACK_OPTION_READFORWARDONLY         = 0x8
     }   MSIX_PACKUNPACK_OPTION;
 
 typedef /* [v1_enum] */
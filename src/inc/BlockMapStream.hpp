@@ -12,28 +12,52 @@
 #include "ComHelper.hpp"
 #include "SHA256.hpp"
 #include "AppxFactory.hpp"
+#include "ICompressionObject.hpp"
+#include "WorkerPool.hpp"
 
 #include <string>
 #include <map>
 #include <functional>
 #include <algorithm>
 #include <vector>
+#include <array>
+#include <cstring>
+#include <thread>
+#include <atomic>
+#include <limits>
 
 namespace MSIX {
   
     const std::uint64_t BLOCKMAP_BLOCK_SIZE = 65536; // 64KB
+    const std::size_t   BLOCKMAP_HASH_SIZE  = 32;    // SHA256
 
     typedef struct Block
     {
         std::uint64_t compressedSize;
         std::uint64_t blockSize;
-        std::vector<std::uint8_t> hash;
+        std::array<std::uint8_t, BLOCKMAP_HASH_SIZE> hash;
     } Block;
 
+    // The blocks of one file of the blockmap. They are owned by the AppxBlockMapObject, which keeps the blocks
+    // of all its files in one vector.
+    struct BlockSpan
+    {
+        const Block* data  = nullptr;
+        std::size_t  count = 0;
+
+        const Block* begin() const { return data; }
+        const Block* end() const { return data + count; }
+        std::size_t size() const { return count; }
+        bool empty() const { return count == 0; }
+        const Block& operator[](std::size_t index) const { return data[index]; }
+    };
+
     typedef struct BlockPlusStream : Block
     {
         std::uint64_t   size;
         std::uint64_t   offset;         
+        std::uint64_t   compressedOffset;
+        bool            validated;
         ComPtr<IStream> stream;
     } BlockPlusStream;
 
@@ -41,7 +65,7 @@ namespace MSIX {
     class BlockMapStream final : public StreamBase
     {
     public:
-        BlockMapStream(IMsixFactory* factory, std::string decodedName, const ComPtr<IStream>& stream, std::vector<Block>& blocks)
+        BlockMapStream(IMsixFactory* factory, std::string decodedName, const ComPtr<IStream>& stream, const BlockSpan& blocks)
             : m_factory(factory), m_decodedName(decodedName), m_stream(stream)
         {
             // Determine overall stream size
@@ -51,31 +75,57 @@ namespace MSIX {
             ThrowHrIfFailed(stream->Seek(li, STREAM_SEEK_END, &uli));
             
             m_streamSize = uli.QuadPart;
+            stream->QueryInterface(UuidOfImpl<IStreamBuffer>::iid, reinterpret_cast<void**>(&m_streamBuffer));
 
             // Reset seek position to beginning
             li.QuadPart = 0;
             ThrowHrIfFailed(stream->Seek(li, STREAM_SEEK_SET, nullptr));
 
-            // Build a vector of all HashStream->RangeStream's for the blocks in the blockmap
+            // Build a flat table of the blocks in the blockmap. Block i starts at i * BLOCKMAP_BLOCK_SIZE, so a
+            // position maps straight to its block. The HashStream->RangeStream of a block is only created the
+            // first time the block is read, see GetBlockStream.
             std::uint64_t offset = 0;
             std::uint64_t sizeRemaining = m_streamSize;
+            m_blockStreams.reserve(std::min(blocks.size(), static_cast<std::size_t>((m_streamSize + BLOCKMAP_BLOCK_SIZE - 1) / BLOCKMAP_BLOCK_SIZE)));
             for (auto block = blocks.begin(); ((sizeRemaining != 0) && (block != blocks.end())); block++)
             {
-                auto rangeStream = ComPtr<IStream>::Make<RangeStream>(offset, std::min(sizeRemaining, BLOCKMAP_BLOCK_SIZE), stream);                
-                auto hashStream = ComPtr<IStream>::Make<HashStream>(rangeStream, block->hash);
                 std::uint64_t blockSize = std::min(sizeRemaining, BLOCKMAP_BLOCK_SIZE);
 
                 BlockPlusStream bs;
                 bs.offset = offset;
                 bs.size   = blockSize;
-                bs.stream = hashStream;
                 bs.hash   = block->hash;
+                bs.compressedOffset = 0;
+                bs.validated        = false;
+                bs.compressedSize   = block->compressedSize;
+                bs.blockSize        = block->blockSize;
                 m_blockStreams.emplace_back(std::move(bs));
                 
                 offset          += blockSize;
                 sizeRemaining   -= blockSize;
             }
 
+            // MakeAppx compresses every block with Z_FULL_FLUSH, so each block of a deflated file starts on a
+            // byte boundary with an empty dictionary and can be inflated on its own. If the compressed sizes of
+            // the blockmap account for the whole file (see AppxPackageObject::VerifyFile for the 2 extra bytes)
+            // the blocks are inflated and verified in batches on the WorkerPool instead of through the InflateStream.
+            auto compressedStream = stream.As<IStreamInternal>()->GetCompressedStream();
+            if (compressedStream && !m_blockStreams.empty() && (offset == m_streamSize))
+            {
+                std::uint64_t compressedOffset = 0;
+                for (auto& block : m_blockStreams)
+                {
+                    block.compressedOffset = compressedOffset;
+                    compressedOffset += block.compressedSize;
+                }
+                auto sizeOnZip = compressedStream.As<IStreamInternal>()->GetSizeOnZip();
+                if ((compressedOffset == sizeOnZip) || (compressedOffset + 2 == sizeOnZip))
+                {
+                    m_compressedStream = compressedStream;
+                    compressedStream->QueryInterface(UuidOfImpl<IStreamBuffer>::iid, reinterpret_cast<void**>(&m_compressedBuffer));
+                }
+            }
+
             // Reset seek position to beginning
             ThrowHrIfFailed(stream->Seek(li, STREAM_SEEK_SET, nullptr));
             ThrowHrIfFailed(Seek(li, STREAM_SEEK_SET, nullptr));
@@ -99,49 +149,113 @@ namespace MSIX {
             }
             m_relativePosition = std::max((std::uint64_t)0, std::min(m_relativePosition, m_streamSize));
             if (newPosition) { newPosition->QuadPart = m_relativePosition; }
-
-            m_currentBlock = m_blockStreams.begin();
             return S_OK;
         } CATCH_RETURN();
 
         HRESULT STDMETHODCALLTYPE Read(void* buffer, ULONG countBytes, ULONG* actualRead) noexcept override try
         {
             std::uint32_t bytesRead = 0;
-            if (m_relativePosition < m_streamSize)
+            if (m_relativePosition < m_streamSize && m_compressedStream)
             {
                 std::uint32_t bytesToRead = std::min(static_cast<std::uint32_t>(countBytes), static_cast<std::uint32_t>(m_streamSize - m_relativePosition));
-                while (m_currentBlock != m_blockStreams.end() && bytesToRead > 0)
+                auto last = static_cast<std::size_t>((m_relativePosition + bytesToRead - 1) / BLOCKMAP_BLOCK_SIZE);
+                while (bytesToRead > 0)
                 {
-                    if ((m_currentBlock->offset + m_currentBlock->size) <= m_relativePosition)
-                    {
-                        m_currentBlock++;
-                    }
-                    else if (m_currentBlock->offset <= m_relativePosition)
-                    {
-                        std::uint64_t positionInBlock = m_relativePosition - m_currentBlock->offset;
-                        LARGE_INTEGER li{0};
-                        li.QuadPart = positionInBlock;
-                        ThrowHrIfFailed(m_currentBlock->stream->Seek(li, STREAM_SEEK_SET, nullptr));
-
-                        std::uint32_t count = std::min(bytesToRead, static_cast<std::uint32_t>(m_currentBlock->size - positionInBlock));
-                        ULONG actual = 0;
-                        ThrowHrIfFailed(m_currentBlock->stream->Read(buffer, count, &actual));
-
-                        buffer = static_cast<std::uint8_t*>(buffer) + actual;
-                        m_relativePosition += actual;
-                        bytesToRead -= actual;
-                        bytesRead += actual;
-                    }
-                    else
-                    {
-                        m_currentBlock = m_blockStreams.begin();
-                    }
+                    auto index = static_cast<std::size_t>(m_relativePosition / BLOCKMAP_BLOCK_SIZE);
+                    const auto& inflatedBlock = GetVerifiedBlock(index, last);
+                    std::uint64_t positionInBlock = m_relativePosition - m_blockStreams[index].offset;
+                    std::uint32_t count = std::min(bytesToRead, static_cast<std::uint32_t>(inflatedBlock.size() - positionInBlock));
+                    std::memcpy(buffer, inflatedBlock.data() + positionInBlock, count);
+
+                    buffer = static_cast<std::uint8_t*>(buffer) + count;
+                    m_relativePosition += count;
+                    bytesToRead -= count;
+                    bytesRead += count;
+                }
+                // Done with the file, give the buffers back for the next one
+                if (m_relativePosition == m_streamSize) { m_verifiedBlocks.clear(); }
+            }
+            else if (m_relativePosition < m_streamSize)
+            {
+                std::uint32_t bytesToRead = std::min(static_cast<std::uint32_t>(countBytes), static_cast<std::uint32_t>(m_streamSize - m_relativePosition));
+                while (bytesToRead > 0)
+                {
+                    auto index = static_cast<std::size_t>(m_relativePosition / BLOCKMAP_BLOCK_SIZE);
+                    if (index >= m_blockStreams.size()) { break; }
+                    const auto& blockStream = GetBlockStream(index);
+                    std::uint64_t positionInBlock = m_relativePosition - m_blockStreams[index].offset;
+                    LARGE_INTEGER li{0};
+                    li.QuadPart = positionInBlock;
+                    ThrowHrIfFailed(blockStream->Seek(li, STREAM_SEEK_SET, nullptr));
+
+                    std::uint32_t count = std::min(bytesToRead, static_cast<std::uint32_t>(m_blockStreams[index].size - positionInBlock));
+                    ULONG actual = 0;
+                    ThrowHrIfFailed(blockStream->Read(buffer, count, &actual));
+                    if (actual == 0) { break; }
+
+                    buffer = static_cast<std::uint8_t*>(buffer) + actual;
+                    m_relativePosition += actual;
+                    bytesToRead -= actual;
+                    bytesRead += actual;
                 }
             }
             if (actualRead) { *actualRead = bytesRead; }
             return (countBytes == bytesRead) ? S_OK : S_FALSE;
         } CATCH_RETURN();
 
+        // Used by Unpack. Instead of going through Read and the HashStream/RangeStream/InflateStream of each
+        // block, every block is inflated or read once into a buffer, verified there and written from it to
+        // the target as a whole. Stored files that can be viewed in place are written straight from the view.
+        HRESULT STDMETHODCALLTYPE CopyTo(IStream* stream, ULARGE_INTEGER bytesCount, ULARGE_INTEGER* bytesRead, ULARGE_INTEGER* bytesWritten) noexcept override try
+        {
+            if (bytesRead) { bytesRead->QuadPart = 0; }
+            if (bytesWritten) { bytesWritten->QuadPart = 0; }
+            ThrowErrorIf(Error::InvalidParameter, (nullptr == stream), "invalid parameter.");
+
+            std::uint64_t start = m_relativePosition;
+            std::uint64_t end = start + std::min(static_cast<std::uint64_t>(bytesCount.QuadPart), m_streamSize - start);
+            const std::uint8_t* view = nullptr;
+            if (!m_compressedStream && GetBuffer(start, end - start, &view))
+            {
+                Write(stream, view, end - start);
+                m_relativePosition = end;
+            }
+            while (m_relativePosition < end)
+            {
+                auto index = static_cast<std::size_t>(m_relativePosition / BLOCKMAP_BLOCK_SIZE);
+                if (index >= m_blockStreams.size()) { break; }
+                const auto& block = GetVerifiedBlock(index, static_cast<std::size_t>((end - 1) / BLOCKMAP_BLOCK_SIZE));
+                std::uint64_t positionInBlock = m_relativePosition - m_blockStreams[index].offset;
+                std::uint64_t count = std::min(block.size() - positionInBlock, end - m_relativePosition);
+                Write(stream, block.data() + positionInBlock, count);
+                m_relativePosition += count;
+            }
+            // Done with the file, give the buffers back for the next one
+            if (m_relativePosition == m_streamSize) { m_verifiedBlocks.clear(); }
+
+            if (bytesRead)      { bytesRead->QuadPart = m_relativePosition - start; }
+            if (bytesWritten)   { bytesWritten->QuadPart = m_relativePosition - start; }
+            return static_cast<HRESULT>(Error::OK);
+        } CATCH_RETURN();
+
+        // The clone reads through a clone of the underlying stream and validates its blocks again.
+        HRESULT STDMETHODCALLTYPE Clone(IStream** stream) noexcept override try
+        {
+            ThrowErrorIf(Error::InvalidParameter, (stream == nullptr || *stream != nullptr), "bad pointer");
+            ComPtr<IStream> clonedStream;
+            ThrowHrIfFailed(m_stream->Clone(&clonedStream));
+            std::vector<Block> blocks(m_blockStreams.begin(), m_blockStreams.end());
+            BlockSpan span;
+            span.data  = blocks.data();
+            span.count = blocks.size();
+            auto clone = ComPtr<IStream>::Make<BlockMapStream>(m_factory, m_decodedName, clonedStream, span);
+            LARGE_INTEGER position = { 0 };
+            position.QuadPart = static_cast<LONGLONG>(m_relativePosition);
+            ThrowHrIfFailed(clone->Seek(position, Reference::START, nullptr));
+            *stream = clone.Detach();
+            return static_cast<HRESULT>(Error::OK);
+        } CATCH_RETURN();
+
         // IStreamInternal
         std::uint64_t GetSizeOnZip() override
         {   // The underlying ZipFileStream/InflateStream object knows, so go ask it.
@@ -157,14 +271,210 @@ namespace MSIX {
         {   // The underlying ZipFileStream/InflateStream object knows, so go ask it.
             return m_stream.As<IStreamInternal>()->GetName();
         }
+
+        // IStreamBuffer
+        bool GetBuffer(std::uint64_t offset, std::uint64_t size, const std::uint8_t** buffer) override
+        {
+            if (!m_streamBuffer || offset > m_streamSize || size > (m_streamSize - offset)) { return false; }
+            // Every block in the range has to be validated before the underlying bytes are handed out. The ones
+            // that haven't been yet are hashed as one batch.
+            std::vector<std::size_t> pending;
+            std::vector<SHA256::Buffer> buffers;
+            for (auto index = offset / BLOCKMAP_BLOCK_SIZE; (index < m_blockStreams.size()) && (m_blockStreams[index].offset < offset + size); index++)
+            {
+                const auto& block = m_blockStreams[index];
+                if (block.validated) { continue; }
+                const std::uint8_t* blockBuffer = nullptr;
+                if (!m_streamBuffer->GetBuffer(block.offset, block.size, &blockBuffer))
+                {   return false;
+                }
+                pending.push_back(static_cast<std::size_t>(index));
+                buffers.emplace_back(blockBuffer, static_cast<std::uint32_t>(block.size));
+            }
+            std::vector<std::vector<std::uint8_t>> hashes;
+            SHA256::ComputeHashes(buffers, hashes);
+            for (std::size_t i = 0; i < pending.size(); i++)
+            {
+                VerifyBlockHash(m_blockStreams[pending[i]], hashes[i]);
+                m_blockStreams[pending[i]].validated = true;
+            }
+            return m_streamBuffer->GetBuffer(offset, size, buffer);
+        }
       
     protected:
-        std::vector<BlockPlusStream>::iterator m_currentBlock;
+        // Most blocks inflated per batch for each thread of the machine. Only one batch is kept in memory.
+        static const std::size_t BlocksPerWorker = 4;
+        // Number of blocks a worker inflates before hashing them together.
+        static const std::size_t BlocksPerHash = 2;
+        // Number of stored blocks read and hashed together when they can't be viewed in place.
+        static const std::size_t BlocksPerRead = 8;
+
+        const ComPtr<IStream>& GetBlockStream(std::size_t index)
+        {
+            auto& block = m_blockStreams[index];
+            if (!block.stream)
+            {
+                auto rangeStream = ComPtr<IStream>::Make<RangeStream>(block.offset, block.size, m_stream);
+                block.stream = ComPtr<IStream>::Make<HashStream>(rangeStream, block.hash.data(), block.hash.size());
+            }
+            return block.stream;
+        }
+
+        // Returns the contents of a block once its hash has been checked. Blocks are inflated, or read when the
+        // file is stored, in batches starting at the requested one and going no further than last, the last
+        // block the caller needs.
+        const std::vector<std::uint8_t>& GetVerifiedBlock(std::size_t index, std::size_t last)
+        {
+            if ((index < m_firstVerifiedBlock) || (index >= m_firstVerifiedBlock + m_verifiedBlocks.size()))
+            {
+                last = std::min(last, m_blockStreams.size() - 1);
+                if (m_compressedStream) { InflateBlocks(index, last); }
+                else                    { ReadBlocks(index, last); }
+            }
+            return *m_verifiedBlocks[index - m_firstVerifiedBlock];
+        }
+
+        // Reads a batch of stored blocks, or inflates them through the InflateStream, and hashes them together.
+        void ReadBlocks(std::size_t first, std::size_t last)
+        {
+            m_verifiedBlocks.clear();
+            std::size_t count = std::min(BlocksPerRead, last - first + 1);
+            LARGE_INTEGER li{0};
+            li.QuadPart = m_blockStreams[first].offset;
+            ThrowHrIfFailed(m_stream->Seek(li, STREAM_SEEK_SET, nullptr));
+
+            std::vector<BufferPool::Buffer> blocks(count);
+            std::vector<SHA256::Buffer> buffers;
+            for (std::size_t i = 0; i < count; i++)
+            {
+                const auto& block = m_blockStreams[first + i];
+                blocks[i] = BufferPool::Get(static_cast<std::size_t>(block.size));
+                ULONG bytesRead = 0;
+                ThrowHrIfFailed(m_stream->Read(blocks[i]->data(), static_cast<ULONG>(block.size), &bytesRead));
+                ThrowErrorIfNot(Error::FileRead, (bytesRead == block.size), "read failed");
+                buffers.emplace_back(blocks[i]->data(), static_cast<std::uint32_t>(block.size));
+            }
+            std::vector<std::vector<std::uint8_t>> hashes;
+            SHA256::ComputeHashes(buffers, hashes);
+            for (std::size_t i = 0; i < count; i++)
+            {
+                VerifyBlockHash(m_blockStreams[first + i], hashes[i]);
+                m_blockStreams[first + i].validated = true;
+            }
+
+            m_verifiedBlocks = std::move(blocks);
+            m_firstVerifiedBlock = first;
+        }
+
+        static void Write(IStream* stream, const std::uint8_t* data, std::uint64_t size)
+        {
+            while (size > 0)
+            {
+                ULONG written = 0;
+                ULONG chunk = static_cast<ULONG>(std::min(size, static_cast<std::uint64_t>(std::numeric_limits<ULONG>::max())));
+                ThrowHrIfFailed(stream->Write(reinterpret_cast<const void*>(data), chunk, &written));
+                ThrowErrorIf(Error::FileWrite, (written == 0), "write failed");
+                data += written;
+                size -= written;
+            }
+        }
+
+        void InflateBlocks(std::size_t first, std::size_t last)
+        {
+            m_verifiedBlocks.clear();
+            std::size_t count = std::min(static_cast<std::size_t>(std::max(std::thread::hardware_concurrency(), 1u)) * BlocksPerWorker, last - first + 1);
+
+            // The compressed bytes are gathered on this thread, the streams underneath can't be shared between
+            // workers. Workers only inflate and hash.
+            std::vector<const std::uint8_t*> inputs(count, nullptr);
+            std::vector<BufferPool::Buffer> compressedBlocks(count);
+            for (std::size_t i = 0; i < count; i++)
+            {
+                const auto& block = m_blockStreams[first + i];
+                if (!(m_compressedBuffer && m_compressedBuffer->GetBuffer(block.compressedOffset, block.compressedSize, &inputs[i])))
+                {
+                    LARGE_INTEGER li{0};
+                    li.QuadPart = block.compressedOffset;
+                    ThrowHrIfFailed(m_compressedStream->Seek(li, STREAM_SEEK_SET, nullptr));
+                    compressedBlocks[i] = BufferPool::Get(static_cast<std::size_t>(block.compressedSize));
+                    ULONG bytesRead = 0;
+                    ThrowHrIfFailed(m_compressedStream->Read(compressedBlocks[i]->data(), static_cast<ULONG>(block.compressedSize), &bytesRead));
+                    ThrowErrorIfNot(Error::FileRead, (bytesRead == block.compressedSize), "read failed");
+                    inputs[i] = compressedBlocks[i]->data();
+                }
+            }
+
+            // Buffers are taken from and given back to the pool of this thread, never the workers'.
+            std::vector<BufferPool::Buffer> inflatedBlocks(count);
+            for (std::size_t i = 0; i < count; i++)
+            {   inflatedBlocks[i] = BufferPool::Get(static_cast<std::size_t>(m_blockStreams[first + i].size));
+            }
+            // A block that doesn't inflate on its own, or whose hash doesn't match, may just not have been
+            // compressed independently. Those don't throw, the whole batch is done again below.
+            std::atomic<bool> inflated(true);
+            WorkerPool::Run((count + BlocksPerHash - 1) / BlocksPerHash, [&](std::size_t job)
+            {
+                std::vector<SHA256::Buffer> buffers;
+                for (auto i = job * BlocksPerHash; (i < std::min(count, (job + 1) * BlocksPerHash)) && inflated; i++)
+                {
+                    if (!InflateBlock(inputs[i], m_blockStreams[first + i], *inflatedBlocks[i]))
+                    {   inflated = false;
+                        return;
+                    }
+                    buffers.emplace_back(inflatedBlocks[i]->data(), static_cast<std::uint32_t>(inflatedBlocks[i]->size()));
+                }
+                std::vector<std::vector<std::uint8_t>> hashes;
+                SHA256::ComputeHashes(buffers, hashes);
+                for (std::size_t i = 0; i < hashes.size(); i++)
+                {
+                    if (!IsBlockHash(m_blockStreams[first + job * BlocksPerHash + i], hashes[i])) { inflated = false; }
+                }
+            });
+
+            if (!inflated)
+            {   // Go through the InflateStream from now on. It reports the file as corrupt if it really is.
+                m_compressedStream = nullptr;
+                m_compressedBuffer = nullptr;
+                ReadBlocks(first, last);
+                return;
+            }
+            m_verifiedBlocks = std::move(inflatedBlocks);
+            m_firstVerifiedBlock = first;
+        }
+
+        // Inflates one independently compressed block into output, which is sized to the block. The block
+        // ends on a flush point, so all of its input is consumed and fills exactly the block. Every thread
+        // keeps its own compression object for this.
+        static bool InflateBlock(const std::uint8_t* input, const BlockPlusStream& block, std::vector<std::uint8_t>& output)
+        {
+            static thread_local std::unique_ptr<ICompressionObject> compressionObject;
+            if (!compressionObject) { compressionObject = CreateCompressionObject(); }
+            auto status = compressionObject->InflateBuffer(input, static_cast<std::size_t>(block.compressedSize), output.data(), output.size());
+            return (status == CompressionStatus::Ok);
+        }
+
+        static bool IsBlockHash(const BlockPlusStream& block, const std::vector<std::uint8_t>& hash)
+        {
+            return (block.hash.size() == hash.size()) && (std::memcmp(block.hash.data(), hash.data(), hash.size()) == 0);
+        }
+
+        static void VerifyBlockHash(const BlockPlusStream& block, const std::vector<std::uint8_t>& hash)
+        {
+            ThrowErrorIfNot(Error::SignatureInvalid, IsBlockHash(block, hash), "Signature hash doesn't match digest hash");
+        }
+
         std::vector<BlockPlusStream> m_blockStreams;
         std::uint64_t m_relativePosition;
         std::uint64_t m_streamSize;
         std::string m_decodedName;
         ComPtr<IStream> m_stream;
+        ComPtr<IStreamBuffer> m_streamBuffer;
         IMsixFactory* m_factory;
+        // Only set when the blocks of the file can be inflated independently.
+        ComPtr<IStream> m_compressedStream;
+        ComPtr<IStreamBuffer> m_compressedBuffer;
+        // The last batch of blocks that were inflated, or read, and verified by CopyTo or Read
+        std::vector<BufferPool::Buffer> m_verifiedBlocks;
+        std::size_t m_firstVerifiedBlock = 0;
     };
 }
\ No newline at end of file
@@ -0,0 +1,90 @@
+//
+//  Copyright (C) 2017 Microsoft.  All rights reserved.
+//  See LICENSE file in the project root for full license information.
+// 
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+namespace MSIX {
+
+    // Recycles the byte buffers of the hot read paths (inflate windows, hash caches, copy buffers) so
+    // extracting a package doesn't allocate for every block. Each thread has its own pool, so there is no
+    // locking; a buffer goes back to the pool of the thread that releases it.
+    class BufferPool
+    {
+    public:
+        struct Releaser
+        {
+            void operator()(std::vector<std::uint8_t>* buffer) const { BufferPool::Release(buffer); }
+        };
+        typedef std::unique_ptr<std::vector<std::uint8_t>, Releaser> Buffer;
+
+        // Gets a buffer of exactly size bytes. Its contents are unspecified.
+        static Buffer Get(std::size_t size)
+        {
+            if (!IsPoolDestroyed())
+            {   // Use the smallest buffer that fits, so small requests don't take the big buffers.
+                auto& pool = ThreadPool();
+                auto best = pool.buffers.end();
+                for (auto buffer = pool.buffers.begin(); buffer != pool.buffers.end(); buffer++)
+                {
+                    if (((*buffer)->capacity() >= size) && ((best == pool.buffers.end()) || ((*buffer)->capacity() < (*best)->capacity())))
+                    {   best = buffer;
+                    }
+                }
+                if (best != pool.buffers.end())
+                {
+                    auto result = std::move(*best);
+                    pool.buffers.erase(best);
+                    pool.pooledBytes -= result->capacity();
+                    result->resize(size);
+                    return Buffer(result.release());
+                }
+            }
+            return Buffer(new std::vector<std::uint8_t>(size));
+        }
+
+    protected:
+        // Buffers past this are freed instead of kept.
+        static const std::size_t MaxPooledBytes = 4 * 1024 * 1024;
+
+        struct Pool
+        {
+            ~Pool() { IsPoolDestroyed() = true; }
+            std::vector<std::unique_ptr<std::vector<std::uint8_t>>> buffers;
+            std::size_t pooledBytes = 0;
+        };
+
+        // Set once the pool of the thread is gone, buffers released after that are just freed.
+        static bool& IsPoolDestroyed()
+        {
+            static thread_local bool destroyed = false;
+            return destroyed;
+        }
+
+        static Pool& ThreadPool()
+        {
+            static thread_local Pool pool;
+            return pool;
+        }
+
+        static void Release(std::vector<std::uint8_t>* buffer)
+        {
+            std::unique_ptr<std::vector<std::uint8_t>> owned(buffer);
+            if (IsPoolDestroyed()) { return; } // the thread is exiting
+            auto& pool = ThreadPool();
+            if (pool.pooledBytes + owned->capacity() <= MaxPooledBytes)
+            {   // Called from destructors, so a buffer the pool has no room for is freed rather than thrown over.
+                try
+                {   pool.buffers.push_back(std::move(owned));
+                    pool.pooledBytes += pool.buffers.back()->capacity();
+                }
+                catch (...) {}
+            }
+        }
+    };
+}
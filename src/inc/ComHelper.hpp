@@ -182,12 +182,12 @@ namespace MSIX {
 
         virtual ULONG STDMETHODCALLTYPE AddRef() override { return ++m_ref; }
         virtual ULONG STDMETHODCALLTYPE Release() override
-        {
-            if (--m_ref == 0)
+        {   // m_ref can't be read again once it's released, another thread may be deleting the object.
+            auto ref = --m_ref;
+            if (ref == 0)
             {   delete this;
-                return 0;
             }
-            return m_ref;
+            return ref;
         }
 
         virtual HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** ppvObject) override
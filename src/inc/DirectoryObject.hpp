@@ -8,6 +8,7 @@
 #include <vector>
 #include <map>
 #include <memory>
+#include <mutex>
 
 #include "Exceptions.hpp"
 #include "StreamBase.hpp"
@@ -19,17 +20,38 @@ namespace MSIX {
     class DirectoryObject final : public ComClass<DirectoryObject, IStorageObject>
     {
     public:
-        DirectoryObject(std::string root) : m_root(std::move(root)) {}
+        // unbufferedWrites asks for large files to be written past the file system cache where the
+        // platform supports it.
+        DirectoryObject(std::string root, bool unbufferedWrites = false) : m_root(std::move(root)), m_unbufferedWrites(unbufferedWrites) {}
+        ~DirectoryObject();
 
         // StorageObject methods
         const char* GetPathSeparator() override;
         std::vector<std::string> GetFileNames(FileNameOptions options) override;
         ComPtr<IStream> GetFile(const std::string& fileName) override;
         ComPtr<IStream> OpenFile(const std::string& fileName, MSIX::FileStream::Mode mode) override;
+        void WillRead(const std::string& fileName) override {}
         std::string GetFileName() override { NOTIMPLEMENTED; }
 
+        // Moves a file under the root to another name under it, creating the directories of the new name
+        // and replacing a file that is already there.
+        void RenameFile(const std::string& fileName, const std::string& newName);
+        // Deletes a file, or an empty directory, under the root. Returns false if it couldn't.
+        bool Remove(const std::string& fileName);
+
     protected:
         std::string m_root;
+        bool        m_unbufferedWrites = false;
+        #ifndef WIN32
+        int GetDirectory(const std::string& path);
+
+        // Directories already created under m_root, keyed by their path relative to it ("" is m_root).
+        // Up to MaxOpenDirectories of them are kept open so files can be created with openat; the rest
+        // are only remembered as created (-1).
+        std::mutex                 m_directoriesLock;
+        std::map<std::string, int> m_directories;
+        std::size_t                m_openDirectories = 0;
+        #endif
 
     };//class DirectoryObject
 }
\ No newline at end of file
@@ -192,4 +192,54 @@ namespace MSIX {
         }
         return result;
     }
+
+    // Decodes the length chars at value into the size bytes at buffer. Only takes the canonical encoding of
+    // exactly size bytes: padded, without whitespace and with the unused bits of the last char cleared.
+    // Returns false for anything else, which a more lenient decoder may still take.
+    template<class CharT>
+    static bool DecodeBase64(const CharT* value, std::size_t length, std::uint8_t* buffer, std::size_t size)
+    {
+        if (((length % 4) != 0) || ((length / 4) != ((size + 2) / 3)))
+        {   return false;
+        }
+        // The last four chars end with one '=' for each byte short of three.
+        std::size_t padding = (3 - (size % 3)) % 3;
+        std::size_t decoded = 0;
+        for (std::size_t index = 0; index < length; index += 4)
+        {
+            std::size_t digits = (index + 4 == length) ? (4 - padding) : 4;
+            std::uint32_t bits = 0;
+            for (std::size_t i = 0; i < 4; i++)
+            {
+                auto c = static_cast<std::uint32_t>(value[index + i]);
+                std::uint32_t digit = (c < 128) ? base64DecoderRing[c] : 0xFF;
+                if ((i < digits) ? (digit >= 64) : (digit != 64))
+                {   return false;
+                }
+                bits = (bits << 6) | ((i < digits) ? digit : 0);
+            }
+            for (std::size_t i = 0; i < 3; i++)
+            {
+                auto byte = static_cast<std::uint8_t>(bits >> (16 - (8 * i)));
+                if (decoded < size) { buffer[decoded++] = byte; }
+                else if (byte != 0) { return false; }
+            }
+        }
+        return true;
+    }
+
+    // Decodes value into the size bytes at buffer with DecodeBase64, or GetBase64DecodedValue if it isn't the
+    // canonical encoding. Returns false if it doesn't decode to size bytes.
+    static bool GetBase64DecodedValue(const std::string& value, std::uint8_t* buffer, std::size_t size)
+    {
+        if (DecodeBase64(value.c_str(), value.size(), buffer, size))
+        {   return true;
+        }
+        auto decoded = GetBase64DecodedValue(value);
+        if (decoded.size() != size)
+        {   return false;
+        }
+        std::copy(decoded.begin(), decoded.end(), buffer);
+        return true;
+    }
 }
\ No newline at end of file
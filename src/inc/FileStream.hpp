@@ -8,6 +8,14 @@
 #include <string>
 #include <cstdio>
 
+#ifdef WIN32
+#include <io.h>
+#else
+#include <cerrno>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
 #include "Exceptions.hpp"
 #include "StreamBase.hpp"
 #include "UnicodeConversion.hpp"
@@ -18,7 +26,7 @@ namespace MSIX {
     public:
         enum Mode { READ = 0, WRITE, APPEND, READ_UPDATE, WRITE_UPDATE, APPEND_UPDATE };
 
-        FileStream(const std::string& name, Mode mode) : m_name(name)
+        FileStream(const std::string& name, Mode mode) : m_name(name), m_isWritable(mode != Mode::READ)
         {
             static const char* modes[] = { "rb", "wb", "ab", "r+b", "w+b", "a+b" };
             #ifdef WIN32
@@ -26,20 +34,16 @@ namespace MSIX {
             std::ostringstream builder;
             builder << "file: '" << name << "' does not exist.";
             ThrowErrorIfNot(Error::FileOpen, (err==0), builder.str().c_str());
+            OpenReadHandle();
             #else
             m_file = std::fopen(name.c_str(), modes[mode]);
             ThrowErrorIfNot(Error::FileOpen, (m_file), name.c_str());
             #endif
 
-            // Get size of the file
-            LARGE_INTEGER start = { 0 };
-            ULARGE_INTEGER end = { 0 };
-            ThrowHrIfFailed(Seek(start, StreamBase::Reference::END, &end));
-            ThrowHrIfFailed(Seek(start, StreamBase::Reference::START, nullptr));
-            m_size = end.u.LowPart;
+            ReadSize();
         }
 
-        FileStream(const std::wstring& name, Mode mode)
+        FileStream(const std::wstring& name, Mode mode) : m_isWritable(mode != Mode::READ)
         {
             m_name = utf16_to_utf8(name);
             #ifdef WIN32
@@ -48,17 +52,13 @@ namespace MSIX {
             std::wostringstream builder;
             builder << L"file: '" << name << L"' does not exist.";
             ThrowErrorIfNot(Error::FileOpen, (err==0), "change this");
+            OpenReadHandle();
             #else
             static const char* modes[] = { "rb", "wb", "ab", "r+b", "w+b", "a+b" };
             m_file = std::fopen(m_name.c_str(), modes[mode]);
             ThrowErrorIfNot(Error::FileOpen, (m_file), m_name.c_str());
             #endif
-            // Get size of the file
-            LARGE_INTEGER start = { 0 };
-            ULARGE_INTEGER end = { 0 };
-            ThrowHrIfFailed(Seek(start, StreamBase::Reference::END, &end));
-            ThrowHrIfFailed(Seek(start, StreamBase::Reference::START, nullptr));
-            m_size = end.u.LowPart;
+            ReadSize();
         }
 
         virtual ~FileStream() override
@@ -73,6 +73,13 @@ namespace MSIX {
                 std::fclose(m_file);
                 m_file = nullptr;
             }
+            #ifdef WIN32
+            if (m_readHandle != INVALID_HANDLE_VALUE)
+            {
+                CloseHandle(m_readHandle);
+                m_readHandle = INVALID_HANDLE_VALUE;
+            }
+            #endif
         }
 
         // IStream
@@ -108,7 +115,103 @@ namespace MSIX {
         // IStreamInternal
         std::string GetName() override { return m_name; }
 
+        // IStreamBuffer
+        bool GetFileDescriptor(std::uint64_t offset, int* descriptor, std::uint64_t* descriptorOffset) override
+        {
+            #ifdef WIN32
+            return false;
+            #else
+            Flush();
+            *descriptor = fileno(m_file);
+            *descriptorOffset = offset;
+            return (*descriptor != -1);
+            #endif
+        }
+
+        bool ReadAt(std::uint64_t offset, void* buffer, ULONG countBytes, ULONG* bytesRead) override
+        {
+            // Only what was written needs flushing, the read buffer of m_file doesn't matter to a positioned read.
+            #ifdef WIN32
+            if (m_readHandle == INVALID_HANDLE_VALUE) { return false; }
+            if (m_isWritable) { Flush(); }
+            ULONG amountRead = 0;
+            while (amountRead < countBytes)
+            {
+                std::uint64_t position = offset + amountRead;
+                OVERLAPPED overlapped = {};
+                overlapped.Offset = static_cast<DWORD>(position);
+                overlapped.OffsetHigh = static_cast<DWORD>(position >> 32);
+                DWORD result = 0;
+                if (!ReadFile(m_readHandle, static_cast<std::uint8_t*>(buffer) + amountRead, countBytes - amountRead, &result, &overlapped))
+                {
+                    ThrowErrorIf(Error::FileRead, (GetLastError() != ERROR_HANDLE_EOF), "read failed");
+                    break;
+                }
+                if (result == 0) { break; }
+                amountRead += static_cast<ULONG>(result);
+            }
+            if (bytesRead) { *bytesRead = amountRead; }
+            return true;
+            #else
+            if (m_isWritable) { Flush(); }
+            int descriptor = fileno(m_file);
+            if ((descriptor == -1) || ((countBytes == 0) && (lseek(descriptor, 0, SEEK_CUR) == -1))) { return false; }
+            ULONG amountRead = 0;
+            while (amountRead < countBytes)
+            {
+                ssize_t result = pread(descriptor, static_cast<std::uint8_t*>(buffer) + amountRead, countBytes - amountRead,
+                    static_cast<off_t>(offset + amountRead));
+                if ((result < 0) && (errno == EINTR)) { continue; }
+                if ((result < 0) && (amountRead == 0) && (errno == ESPIPE)) { return false; }
+                ThrowErrorIf(Error::FileRead, (result < 0), "read failed");
+                if (result == 0) { break; }
+                amountRead += static_cast<ULONG>(result);
+            }
+            if (bytesRead) { *bytesRead = amountRead; }
+            return true;
+            #endif
+        }
+
+        bool GetSize(std::uint64_t* size) override
+        {
+            if (m_isWritable) { Flush(); }
+            #ifdef WIN32
+            LARGE_INTEGER fileSize = { 0 };
+            if ((m_readHandle == INVALID_HANDLE_VALUE) || !GetFileSizeEx(m_readHandle, &fileSize)) { return false; }
+            *size = static_cast<std::uint64_t>(fileSize.QuadPart);
+            #else
+            struct stat fileStat;
+            int descriptor = fileno(m_file);
+            if ((descriptor == -1) || (fstat(descriptor, &fileStat) == -1) || !S_ISREG(fileStat.st_mode)) { return false; }
+            *size = static_cast<std::uint64_t>(fileStat.st_size);
+            #endif
+            return true;
+        }
+
     protected:
+        #ifdef WIN32
+        // ReadAt reads through a handle of its own, which has its own file pointer, so m_file's isn't moved
+        // under it. Only files on disk get one, pipes can't be read at a position.
+        void OpenReadHandle()
+        {
+            auto handle = reinterpret_cast<HANDLE>(_get_osfhandle(_fileno(m_file)));
+            if ((handle != INVALID_HANDLE_VALUE) && (GetFileType(handle) == FILE_TYPE_DISK))
+            {   m_readHandle = ReOpenFile(handle, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, 0);
+            }
+        }
+        #endif
+
+        // Pipes can't seek, they are only ever read front to back. fseek is asked directly because a failing
+        // Seek raises an error, and that is no failure here.
+        void ReadSize()
+        {
+            if (std::fseek(m_file, 0, SEEK_END) == 0)
+            {
+                m_size = Ftell();
+                ThrowErrorIf(Error::FileSeek, (std::fseek(m_file, 0, SEEK_SET) != 0), "seek failed");
+            }
+        }
+
         inline int Ferror() { return std::ferror(m_file); }
         inline bool Feof()  { return 0 != std::feof(m_file); }
         inline void Flush() { std::fflush(m_file); }
@@ -123,5 +226,9 @@ namespace MSIX {
         std::uint64_t m_size = 0;
         std::string m_name;
         FILE* m_file;
+        bool m_isWritable = false;
+        #ifdef WIN32
+        HANDLE m_readHandle = INVALID_HANDLE_VALUE;
+        #endif
     };
 }
@@ -9,6 +9,7 @@
 #include "StreamBase.hpp"
 #include "ComHelper.hpp"
 #include "SHA256.hpp"
+#include "BufferPool.hpp"
 
 #include <string>
 #include <map>
@@ -17,22 +18,33 @@
 
 namespace MSIX {
   
-    // This represents a subset of a Stream
+    // This represents a subset of a Stream. No byte is handed out before the digest of the whole range has
+    // been checked. A read from the start into a buffer that holds the whole range is hashed in the caller's
+    // buffer, anything else validates the range in place or through a cache first.
     class HashStream final : public StreamBase
     {
     protected:
         bool m_validated;
         ComPtr<IStream> m_stream;
-        std::vector<std::uint8_t>& m_expectedHash;
-        std::unique_ptr<std::vector<std::uint8_t>> m_cacheBuffer;
+        const std::uint8_t* m_expectedHash;
+        std::size_t m_expectedHashSize;
+        BufferPool::Buffer m_cacheBuffer;
+        ComPtr<IStreamBuffer> m_streamBuffer;
+        const std::uint8_t* m_view = nullptr;
         std::uint64_t m_relativePosition;
         size_t m_streamSize;
 
     public:
         HashStream(const ComPtr<IStream>& stream, std::vector<std::uint8_t>& expectedHash) :
+            HashStream(stream, expectedHash.data(), expectedHash.size())
+        {}
+
+        // expectedHash is not copied, it has to outlive the stream.
+        HashStream(const ComPtr<IStream>& stream, const std::uint8_t* expectedHash, std::size_t expectedHashSize) :
             m_validated(false),
             m_stream(stream),
             m_expectedHash(expectedHash),
+            m_expectedHashSize(expectedHashSize),
             m_relativePosition(0),
             m_streamSize(0)
         {
@@ -43,32 +55,71 @@ namespace MSIX {
             ThrowHrIfFailed(m_stream->Seek(li, StreamBase::Reference::END, &uli));
             ThrowHrIfFailed(m_stream->Seek(li, StreamBase::Reference::START, nullptr));
             m_streamSize = static_cast<size_t>(uli.u.LowPart);
+            m_stream->QueryInterface(UuidOfImpl<IStreamBuffer>::iid, reinterpret_cast<void**>(&m_streamBuffer));
         }
 
         void Validate()
         {
             if (m_validated) { return; }
 
-            // read stream into cache buffer
-            m_cacheBuffer = std::make_unique<std::vector<std::uint8_t>>(m_streamSize);
-            ULONG bytesRead = 0;
-            ThrowHrIfFailed(m_stream->Read(m_cacheBuffer->data(), static_cast<ULONG>(m_cacheBuffer->size()), &bytesRead));
-            ThrowErrorIfNot(MSIX::Error::SignatureInvalid, bytesRead == m_streamSize, "read failed");
+            // hash the underlying bytes in place if they are in memory, otherwise read stream into cache buffer
+            const std::uint8_t* data = nullptr;
+            if (m_streamBuffer && m_streamBuffer->GetBuffer(0, m_streamSize, &data))
+            {
+                m_view = data;
+            }
+            else
+            {
+                m_cacheBuffer = BufferPool::Get(m_streamSize);
+                LARGE_INTEGER li{0};
+                ThrowHrIfFailed(m_stream->Seek(li, StreamBase::Reference::START, nullptr));
+                ULONG bytesRead = 0;
+                ThrowHrIfFailed(m_stream->Read(m_cacheBuffer->data(), static_cast<ULONG>(m_cacheBuffer->size()), &bytesRead));
+                ThrowErrorIfNot(MSIX::Error::SignatureInvalid, bytesRead == m_streamSize, "read failed");
+                data = m_cacheBuffer->data();
+            }
 
             // compute digest and compare against expected digest
             std::vector<std::uint8_t> hash;
             ThrowErrorIfNot(MSIX::Error::SignatureInvalid, 
-                MSIX::SHA256::ComputeHash(m_cacheBuffer->data(), static_cast<uint32_t>(m_cacheBuffer->size()), hash), 
+                MSIX::SHA256::ComputeHash(const_cast<std::uint8_t*>(data), static_cast<uint32_t>(m_streamSize), hash),
                 "Invalid signature");
-            ThrowErrorIfNot(MSIX::Error::SignatureInvalid, m_expectedHash.size() == hash.size(), "Signature is corrupt");
+            VerifyHash(hash);
+        }
+
+        void VerifyHash(const std::vector<std::uint8_t>& hash)
+        {
+            ThrowErrorIfNot(MSIX::Error::SignatureInvalid, m_expectedHashSize == hash.size(), "Signature is corrupt");
             ThrowErrorIfNot(
                 MSIX::Error::SignatureInvalid,
-                memcmp(m_expectedHash.data(), hash.data(), hash.size()) == 0,
+                memcmp(m_expectedHash, hash.data(), hash.size()) == 0,
                 "Signature hash doesn't match digest hash"); //TODO: better exception
 
             m_validated = true;
         }
 
+        // Reads the whole range from the underlying stream straight into the caller's buffer, which has to be
+        // big enough for it, and checks the digest before returning.
+        void HashRead(void* buffer, ULONG* actualRead)
+        {
+            SHA256 sha256;
+            std::uint8_t* data = static_cast<std::uint8_t*>(buffer);
+            std::uint64_t hashedSize = 0;
+            while (hashedSize < m_streamSize)
+            {
+                ULONG bytesRead = 0;
+                ThrowHrIfFailed(m_stream->Read(data + hashedSize, static_cast<ULONG>(m_streamSize - hashedSize), &bytesRead));
+                ThrowErrorIf(MSIX::Error::SignatureInvalid, (bytesRead == 0), "read failed");
+                sha256.Update(data + hashedSize, bytesRead);
+                hashedSize += bytesRead;
+            }
+            std::vector<std::uint8_t> hash;
+            sha256.FinalizeAndGetHashValue(hash);
+            VerifyHash(hash);
+            m_relativePosition = m_streamSize;
+            if (actualRead) { *actualRead = static_cast<ULONG>(m_streamSize); }
+        }
+
         void CacheSeek(LARGE_INTEGER move, DWORD origin, ULARGE_INTEGER *newPosition)
         {
             LARGE_INTEGER newPos = { 0 };
@@ -90,7 +141,7 @@ namespace MSIX {
 
         HRESULT STDMETHODCALLTYPE Seek(LARGE_INTEGER move, DWORD origin, ULARGE_INTEGER *newPosition) noexcept override try
         {
-            if (m_cacheBuffer.get() == nullptr)
+            if (m_cacheBuffer.get() == nullptr && m_view == nullptr)
             {   ThrowHrIfFailed(m_stream->Seek(move, origin, newPosition));
             }
             // always call into cache seek to keep cache state aligned with the underlying stream state.
@@ -101,10 +152,11 @@ namespace MSIX {
         void CacheRead(void* buffer, ULONG countBytes, ULONG* actualRead)
         {
             ThrowErrorIf(Error::Stg_E_Invalidpointer, (buffer == nullptr), "bad input");
-            ULONG bytesToRead = std::min((std::uint32_t)countBytes, static_cast<std::uint32_t>((std::uint64_t)m_cacheBuffer->size() - m_relativePosition));
+            const std::uint8_t* data = m_view ? m_view : m_cacheBuffer->data();
+            ULONG bytesToRead = std::min((std::uint32_t)countBytes, static_cast<std::uint32_t>((std::uint64_t)m_streamSize - m_relativePosition));
             if (bytesToRead)
             {
-                memcpy(buffer, reinterpret_cast<BYTE*>(m_cacheBuffer->data()) + m_relativePosition, bytesToRead);
+                memcpy(buffer, data + m_relativePosition, bytesToRead);
             }
 
             m_relativePosition += bytesToRead;
@@ -114,8 +166,19 @@ namespace MSIX {
 
         HRESULT STDMETHODCALLTYPE Read(void* buffer, ULONG countBytes, ULONG* actualRead) noexcept override try
         {
-            Validate();
-            if (m_cacheBuffer.get() == nullptr)
+            if (!m_validated && m_cacheBuffer.get() == nullptr && m_view == nullptr)
+            {
+                const std::uint8_t* data = nullptr;
+                if ((m_relativePosition == 0) && (countBytes >= m_streamSize) &&
+                    !(m_streamBuffer && m_streamBuffer->GetBuffer(0, m_streamSize, &data)))
+                {
+                    ThrowErrorIf(Error::Stg_E_Invalidpointer, (buffer == nullptr), "bad input");
+                    HashRead(buffer, actualRead);
+                    return static_cast<HRESULT>(Error::OK);
+                }
+                Validate();
+            }
+            if (m_cacheBuffer.get() == nullptr && m_view == nullptr)
             {   ThrowHrIfFailed(m_stream->Read(buffer, countBytes, actualRead));
             }
             else
@@ -123,5 +186,33 @@ namespace MSIX {
             }
             return static_cast<HRESULT>(Error::OK);
         } CATCH_RETURN();
+
+        // The clone hashes its own bytes, it doesn't share what this stream has validated.
+        HRESULT STDMETHODCALLTYPE Clone(IStream** stream) noexcept override try
+        {
+            ThrowErrorIf(Error::InvalidParameter, (stream == nullptr || *stream != nullptr), "bad pointer");
+            ComPtr<IStream> clonedStream;
+            ThrowHrIfFailed(m_stream->Clone(&clonedStream));
+            auto clone = ComPtr<IStream>::Make<HashStream>(clonedStream, m_expectedHash, m_expectedHashSize);
+            LARGE_INTEGER position = { 0 };
+            position.QuadPart = static_cast<LONGLONG>(m_relativePosition);
+            ThrowHrIfFailed(clone->Seek(position, Reference::START, nullptr));
+            *stream = clone.Detach();
+            return static_cast<HRESULT>(Error::OK);
+        } CATCH_RETURN();
+
+        // IStreamBuffer
+        bool GetBuffer(std::uint64_t offset, std::uint64_t size, const std::uint8_t** buffer) override
+        {   // The bytes are only handed out once they are known to be good.
+            const std::uint8_t* data = nullptr;
+            if (offset > m_streamSize || size > (m_streamSize - offset) || !m_streamBuffer ||
+                !m_streamBuffer->GetBuffer(0, m_streamSize, &data))
+            {   return false;
+            }
+            Validate();
+            if (m_view == nullptr) { return false; }
+            *buffer = m_view + offset;
+            return true;
+        }
     };
 }
@@ -7,6 +7,7 @@
 #include <cstdlib>
 #include <cstdint>
 #include <memory>
+#include <vector>
 
 namespace MSIX {
     enum class CompressionOperation
@@ -28,6 +29,19 @@ namespace MSIX {
         public:
             virtual CompressionStatus Initialize(CompressionOperation operation) = 0;
             virtual CompressionStatus Inflate() = 0;
+            // Same as Inflate, but also returns at the end of every deflate block so the caller
+            // has a chance to create a checkpoint there.
+            virtual CompressionStatus InflateToBlockBoundary() = 0;
+            // Saves what is needed to resume inflating from the current input position. Only possible
+            // when the last call to InflateToBlockBoundary stopped at the end of a deflate block; returns
+            // false otherwise, or if the implementation doesn't support checkpoints.
+            virtual bool CreateCheckpoint(std::vector<std::uint8_t>& checkpoint) = 0;
+            // Reinitializes the object for inflating from the input position where the checkpoint was created.
+            virtual CompressionStatus RestoreCheckpoint(const std::vector<std::uint8_t>& checkpoint) = 0;
+            // Inflates source into destination in one call, independently of the streaming functions above.
+            // source must end at the end of the deflate stream or on a flush point. Returns Ok only if all
+            // of source was consumed and exactly fills destination.
+            virtual CompressionStatus InflateBuffer(const std::uint8_t* source, std::size_t sourceSize, std::uint8_t* destination, std::size_t destinationSize) = 0;
             virtual CompressionStatus Cleanup() = 0;
             virtual std::size_t GetAvailableSourceSize() = 0;
             virtual std::size_t GetAvailableDestinationSize() = 0;
@@ -153,6 +153,8 @@ class IXmlElement : public IUnknown
 public:
     virtual std::string               GetAttributeValue(XmlAttributeName attribute) = 0;
     virtual std::vector<std::uint8_t> GetBase64DecodedAttributeValue(XmlAttributeName attribute) = 0;
+    // Decodes the attribute into the size bytes at buffer. Returns false if it isn't size bytes long.
+    virtual bool                      GetBase64DecodedAttributeValue(XmlAttributeName attribute, std::uint8_t* buffer, std::size_t size) = 0;
     virtual std::string               GetText() = 0;
 };
 
@@ -166,6 +168,16 @@ struct XmlVisitor
     XmlVisitor(void* c, lambda f) : context(c), Callback(f) {}
 };
 
+// Handed the elements of a document in document order by IXmlFactory::ParseFromStream, as they are read.
+// There is no DOM behind them, so an element can only be read during its StartElement.
+struct XmlElementHandler
+{
+    virtual ~XmlElementHandler() {}
+    // depth is 0 for the document element, name is the local name of the element.
+    virtual void StartElement(std::size_t depth, const std::string& name, const MSIX::ComPtr<IXmlElement>& element) = 0;
+    virtual void EndElement(std::size_t depth, const std::string& name) = 0;
+};
+
 #ifndef WIN32
 // {0e7a446e-baf7-44c1-b38a-216bfa18a1a8}
 interface IXmlDom : public IUnknown
@@ -193,6 +205,10 @@ class IXmlFactory : public IUnknown
 {
 public:
     virtual MSIX::ComPtr<IXmlDom> CreateDomFromStream(XmlContentType footPrintType, const MSIX::ComPtr<IStream>& stream) = 0;
+    // Parses the stream front to back without building a DOM, validating it as CreateDomFromStream does, and
+    // hands its elements to handler on the way. Returns false without reading the stream if the parser can't,
+    // then CreateDomFromStream has to be used.
+    virtual bool ParseFromStream(XmlContentType footPrintType, const MSIX::ComPtr<IStream>& stream, XmlElementHandler& handler) = 0;
 };
 
 SpecializeUuidOfImpl(IXmlElement);
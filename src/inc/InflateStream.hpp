@@ -7,6 +7,7 @@
 #include "StreamBase.hpp"
 #include "ComHelper.hpp"
 #include "ICompressionObject.hpp"
+#include "BufferPool.hpp"
 
 #undef max
 #undef min
@@ -21,11 +22,16 @@ namespace MSIX {
     class InflateStream final : public StreamBase
     {
     public:
-        InflateStream(const ComPtr<IStream>& stream, std::uint64_t uncompressedSize);
+        // Memory that may be spent on checkpoints for seeking backwards. Each one costs up to 32KB.
+        static const std::size_t DefaultCheckpointMemoryLimit = 4*1024*1024;
+
+        InflateStream(const ComPtr<IStream>& stream, std::uint64_t uncompressedSize, std::size_t checkpointMemoryLimit = DefaultCheckpointMemoryLimit);
         ~InflateStream();
 
         HRESULT STDMETHODCALLTYPE Seek(LARGE_INTEGER move, DWORD origin, ULARGE_INTEGER *newPosition) noexcept override;
         HRESULT STDMETHODCALLTYPE Read(void* buffer, ULONG countBytes, ULONG* bytesRead) noexcept override;
+        // Inflates again from the start of a clone of the compressed stream, so it needs its ReadAt.
+        HRESULT STDMETHODCALLTYPE Clone(IStream** stream) noexcept override;
         HRESULT STDMETHODCALLTYPE Write(void const *buffer, ULONG countBytes, ULONG *bytesWritten) noexcept override
         {
             return static_cast<HRESULT>(Error::NotImplemented);
@@ -46,7 +52,11 @@ namespace MSIX {
         {   // The underlying ZipFileStream object knows, so go ask it.
             return m_stream.As<IStreamInternal>()->GetName();
         }
+
+        ComPtr<IStream> GetCompressedStream() override { return m_stream; }
         void Cleanup();
+        void CreateCheckpoint();
+        bool RestoreCheckpoint();
 
         enum class State : size_t
         {
@@ -69,11 +79,31 @@ namespace MSIX {
         ULONG           m_inflateWindowPosition = 0;
         ULONGLONG       m_fileCurrentWindowPositionEnd = 0;
         ULONGLONG       m_fileCurrentPosition = 0;
+        // Number of bytes read from m_stream so far
+        ULONGLONG       m_compressedPosition = 0;
+
+        // Points where inflating can resume without starting over, ordered by offset. Created as the
+        // stream is inflated forward, at most one per m_checkpointSpan bytes of output; when they use more
+        // than m_checkpointMemoryLimit every other one is dropped and the span doubles.
+        struct Checkpoint
+        {
+            ULONGLONG                 uncompressedOffset;
+            ULONGLONG                 compressedOffset;
+            std::vector<std::uint8_t> state;
+        };
+        std::vector<Checkpoint> m_checkpoints;
+        const Checkpoint* FindCheckpoint(ULONGLONG position);
+        ULONGLONG               m_checkpointSpan;
+        std::size_t             m_checkpointMemory = 0;
+        std::size_t             m_checkpointMemoryLimit;
+        // Checkpoints are only collected once the stream has been rewound to somewhere other than its
+        // start, most streams are read sequentially and would never use them.
+        bool                    m_collectCheckpoints = false;
 
         std::unique_ptr<ICompressionObject> m_compressionObject;
         CompressionStatus m_compressionStatus = CompressionStatus::Ok;
 
-        std::unique_ptr<std::vector<std::uint8_t>> m_compressedBuffer;
-        std::unique_ptr<std::vector<std::uint8_t>> m_inflateWindow;
+        BufferPool::Buffer m_compressedBuffer;
+        BufferPool::Buffer m_inflateWindow;
     };
 }
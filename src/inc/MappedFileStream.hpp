@@ -0,0 +1,140 @@
+//
+//  Copyright (C) 2017 Microsoft.  All rights reserved.
+//  See LICENSE file in the project root for full license information.
+//
+#pragma once
+
+#include <string>
+#include <cstring>
+#include <limits>
+#include <algorithm>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "Exceptions.hpp"
+#include "StreamBase.hpp"
+#include "ComHelper.hpp"
+
+namespace MSIX {
+    // Read only stream over a file mapped into memory. Read and Seek don't need to go
+    // to the file system once the file is mapped.
+    class MappedFileStream final : public StreamBase
+    {
+    public:
+        // Use Open, which only hands out the stream if the file could be mapped.
+        MappedFileStream(const std::string& name) : m_name(name)
+        {
+            // The file stays open so it can be copied from by the kernel, see GetFileDescriptor.
+            m_fd = open(name.c_str(), O_RDONLY);
+            struct stat fileStat;
+            if ((m_fd == -1) || (fstat(m_fd, &fileStat) == -1) || !S_ISREG(fileStat.st_mode) || (fileStat.st_size <= 0) ||
+                (static_cast<std::uint64_t>(fileStat.st_size) > std::numeric_limits<size_t>::max()))
+            {   return;
+            }
+            void* data = mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ, MAP_PRIVATE, m_fd, 0);
+            if (data != MAP_FAILED)
+            {
+                m_data = static_cast<const std::uint8_t*>(data);
+                m_size = static_cast<std::uint64_t>(fileStat.st_size);
+            }
+        }
+
+        virtual ~MappedFileStream() override
+        {
+            if (m_data)
+            {
+                munmap(const_cast<std::uint8_t*>(m_data), static_cast<size_t>(m_size));
+                m_data = nullptr;
+            }
+            if (m_fd != -1)
+            {
+                close(m_fd);
+                m_fd = -1;
+            }
+        }
+
+        // Maps the file. Returns nullptr if it can't be, then FileStream should be used: the file isn't a regular,
+        // non-empty one (pipes, devices, etc.), it doesn't fit in the address space or mmap fails.
+        static ComPtr<IStream> Open(const std::string& name)
+        {
+            auto stream = ComPtr<MappedFileStream>::Make<MappedFileStream>(name);
+            return (stream->m_data != nullptr) ? stream.As<IStream>() : ComPtr<IStream>();
+        }
+
+        // IStream
+        HRESULT STDMETHODCALLTYPE Seek(LARGE_INTEGER move, DWORD origin, ULARGE_INTEGER* newPosition) noexcept override try
+        {
+            LARGE_INTEGER newPos = { 0 };
+            switch (origin)
+            {
+            case Reference::CURRENT:
+                newPos.QuadPart = static_cast<std::int64_t>(m_offset) + move.QuadPart;
+                break;
+            case Reference::START:
+                newPos.QuadPart = move.QuadPart;
+                break;
+            case Reference::END:
+                newPos.QuadPart = static_cast<std::int64_t>(m_size) + move.QuadPart;
+                break;
+            default:
+                ThrowErrorAndLog(Error::FileSeek, "invalid seek origin");
+            }
+            ThrowErrorIf(Error::FileSeek, (newPos.QuadPart < 0), "seek failed");
+            m_offset = static_cast<std::uint64_t>(newPos.QuadPart);
+            if (newPosition) { newPosition->QuadPart = m_offset; }
+            return static_cast<HRESULT>(Error::OK);
+        } CATCH_RETURN();
+
+        HRESULT STDMETHODCALLTYPE Read(void* buffer, ULONG countBytes, ULONG* bytesRead) noexcept override try
+        {
+            ULONG amountToRead = (m_offset < m_size) ?
+                static_cast<ULONG>(std::min(static_cast<std::uint64_t>(countBytes), m_size - m_offset)) : 0;
+            if (amountToRead > 0) { std::memcpy(buffer, m_data + m_offset, amountToRead); }
+            m_offset += amountToRead;
+            if (bytesRead) { *bytesRead = amountToRead; }
+            return static_cast<HRESULT>(Error::OK);
+        } CATCH_RETURN();
+
+        // IStreamInternal
+        std::string GetName() override { return m_name; }
+
+        // IStreamBuffer
+        bool GetBuffer(std::uint64_t offset, std::uint64_t size, const std::uint8_t** buffer) override
+        {
+            if (offset > m_size || size > (m_size - offset)) { return false; }
+            *buffer = m_data + offset;
+            return true;
+        }
+
+        bool GetFileDescriptor(std::uint64_t offset, int* descriptor, std::uint64_t* descriptorOffset) override
+        {
+            *descriptor = m_fd;
+            *descriptorOffset = offset;
+            return (m_fd != -1);
+        }
+
+        bool ReadAt(std::uint64_t offset, void* buffer, ULONG countBytes, ULONG* bytesRead) override
+        {
+            ULONG amountToRead = (offset < m_size) ? static_cast<ULONG>(std::min(static_cast<std::uint64_t>(countBytes), m_size - offset)) : 0;
+            if (amountToRead > 0) { std::memcpy(buffer, m_data + offset, amountToRead); }
+            if (bytesRead) { *bytesRead = amountToRead; }
+            return true;
+        }
+
+        bool GetSize(std::uint64_t* size) override
+        {
+            *size = m_size;
+            return true;
+        }
+
+    protected:
+        const std::uint8_t* m_data = nullptr;
+        std::uint64_t m_offset = 0;
+        std::uint64_t m_size = 0;
+        std::string m_name;
+        int m_fd = -1;
+    };
+}
@@ -7,6 +7,7 @@
 #include <vector>
 #include <tuple>
 #include <type_traits>
+#include <cstdint>
 #include "Exceptions.hpp"
 #include "StreamBase.hpp"
 
@@ -39,14 +40,31 @@ static void OnlyEitherValueValidation(T value, T spec1, T spec2)
 //////////////////////////////////////////////////////////////////////////////////////////////
 //              Base type for individual serializable/deserializable fields                 //
 //////////////////////////////////////////////////////////////////////////////////////////////
+// Loads an unsigned integer stored in little endian order regardless of the host byte order
+template <class T>
+inline T LoadLittleEndian(const std::uint8_t* data) noexcept
+{
+    static_assert(std::is_unsigned<T>::value, "only unsigned integers can be loaded");
+    T result = 0;
+    for (std::size_t i = 0; i < sizeof(T); i++)
+    {   result |= static_cast<T>(static_cast<T>(data[i]) << (8 * i));
+    }
+    return result;
+}
+
 template <class T>
 class FieldBase
 {
 public:
     FieldBase() = default;
 
+    // number of bytes this field occupies in the fixed size portion of a structured object.
+    static constexpr std::size_t FixedSize = sizeof(T);
+
     size_t Size() { return sizeof(T); }
-    
+
+    void Load(const std::uint8_t* data) noexcept { value = LoadLittleEndian<T>(data); }
+
     T value;
 };
 
@@ -59,7 +77,12 @@ class Field8Bytes final : public FieldBase<std::uint64_t> { };
 class FieldNBytes : public FieldBase<std::vector<std::uint8_t>>
 {
 public:
+    // variable length fields are not part of the fixed size portion and are populated by their owner.
+    static constexpr std::size_t FixedSize = 0;
+
     size_t Size() { return this->value.size(); }
+
+    void Load(const std::uint8_t*) noexcept { }
 };
 
 //////////////////////////////////////////////////////////////////////////////////////////////
@@ -91,6 +114,7 @@ public:
 template <class... Types>
 class StructuredObject : public TypeList<Types...>
 {
+    static constexpr std::size_t last_index { sizeof...(Types) };
 public:
     size_t Size()
     {
@@ -100,6 +124,35 @@ public:
         }, result);
         return result;
     }
+
+    // Offset in bytes of a field from the start of the serialized object. Only meaningful for
+    // fields that are not preceded by a variable length field.
+    static constexpr std::size_t OffsetOf(std::size_t index)
+    {
+        const std::size_t sizes[] = { Types::FixedSize... };
+        std::size_t result = 0;
+        for (std::size_t i = 0; i < index; i++)
+        {   result += sizes[i];
+        }
+        return result;
+    }
+
+    // Size in bytes of all the fixed size fields of the object
+    static constexpr std::size_t FixedSize() { return OffsetOf(last_index); }
+
+    // Populates all fixed size fields from a buffer of at least FixedSize() bytes
+    void Decode(const std::uint8_t* data) noexcept { DecodeField<0>(data); }
+
+private:
+    template <std::size_t index>
+    inline typename std::enable_if<index == last_index, void>::type DecodeField(const std::uint8_t*) noexcept { }
+
+    template <std::size_t index>
+    inline typename std::enable_if<index < last_index, void>::type DecodeField(const std::uint8_t* data) noexcept
+    {
+        this->template Field<index>().Load(data + std::integral_constant<std::size_t, OffsetOf(index)>::value);
+        DecodeField<index + 1>(data);
+    }
 };
 
 } /* namespace Meta */ } /* namespace MSIX */
\ No newline at end of file
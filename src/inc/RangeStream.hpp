@@ -8,21 +8,28 @@
 #include "ComHelper.hpp"
 
 #include <string>
+#include <cstring>
 #include <map>
 #include <functional>
+#include <algorithm>
+#include <memory>
+#include <mutex>
 
 
 namespace MSIX {
 
-    // This represents a subset of a Stream
+    // This represents a subset of a Stream. If other ranges over the same stream can be read concurrently
+    // streamLock must be shared between all of them, unless the stream can ReadAt.
     class RangeStream : public StreamBase
     {
     public:
-        RangeStream(std::uint64_t offset, std::uint64_t size, const ComPtr<IStream>& stream) :
+        RangeStream(std::uint64_t offset, std::uint64_t size, const ComPtr<IStream>& stream, const std::shared_ptr<std::mutex>& streamLock = nullptr) :
             m_offset(offset),
             m_size(size),
-            m_stream(stream)
-        {
+            m_stream(stream),
+            m_streamLock(streamLock)
+        {   // Not every stream can provide views of its bytes, that's fine.
+            m_stream->QueryInterface(UuidOfImpl<IStreamBuffer>::iid, reinterpret_cast<void**>(&m_streamBuffer));
         }
 
         HRESULT STDMETHODCALLTYPE Seek(LARGE_INTEGER move, DWORD origin, ULARGE_INTEGER *newPosition) noexcept override try
@@ -40,22 +47,33 @@ namespace MSIX {
                 newPos.QuadPart = m_offset + m_size + move.QuadPart;
                 break;
             }
-            //TODO: We need to constrain newPos so that it can't exceed the end of the stream
-            ULARGE_INTEGER pos = { 0 };
-            m_stream->Seek(newPos, Reference::START, &pos);
-            m_relativePosition = std::min(static_cast<std::uint64_t>(pos.QuadPart - m_offset), m_size);
+            // The underlying stream is only positioned when reading, so ranges over the same stream
+            // don't disturb each other.
+            newPos.QuadPart = std::max(newPos.QuadPart, static_cast<LONGLONG>(m_offset));
+            m_relativePosition = std::min(static_cast<std::uint64_t>(newPos.QuadPart - m_offset), m_size);
             if (newPosition) { newPosition->QuadPart = m_relativePosition; }
             return static_cast<HRESULT>(Error::OK);
         } CATCH_RETURN();
 
         HRESULT STDMETHODCALLTYPE Read(void* buffer, ULONG countBytes, ULONG* bytesRead) noexcept override try
         {
-            LARGE_INTEGER offset = {0};
-            offset.QuadPart = m_relativePosition + m_offset;
-            ThrowHrIfFailed(m_stream->Seek(offset, StreamBase::START, nullptr));
-            ULONG amountToRead = std::min(countBytes, static_cast<ULONG>(m_size - m_relativePosition));
+            ULONG amountToRead = static_cast<ULONG>(std::min(static_cast<std::uint64_t>(countBytes), m_size - m_relativePosition));
             ULONG amountRead = 0;
-            ThrowHrIfFailed(m_stream->Read(buffer, amountToRead, &amountRead));
+            const std::uint8_t* view = nullptr;
+            if (m_streamBuffer && m_streamBuffer->GetBuffer(m_offset + m_relativePosition, amountToRead, &view))
+            {   // No need to move the underlying stream's seek pointer.
+                if (amountToRead) { memcpy(buffer, view, amountToRead); }
+                amountRead = amountToRead;
+            }
+            else if (!m_streamBuffer || !m_streamBuffer->ReadAt(m_offset + m_relativePosition, buffer, amountToRead, &amountRead))
+            {
+                std::unique_lock<std::mutex> lock;
+                if (m_streamLock) { lock = std::unique_lock<std::mutex>(*m_streamLock); }
+                LARGE_INTEGER offset = {0};
+                offset.QuadPart = m_relativePosition + m_offset;
+                ThrowHrIfFailed(m_stream->Seek(offset, StreamBase::START, nullptr));
+                ThrowHrIfFailed(m_stream->Read(buffer, amountToRead, &amountRead));
+            }
             ThrowErrorIf(Error::FileRead, (amountToRead != amountRead), "Did not read as much as requesteed.");
             m_relativePosition += amountRead;
             if (bytesRead) { *bytesRead = amountRead; }
@@ -63,6 +81,32 @@ namespace MSIX {
             return static_cast<HRESULT>(Error::OK);
         } CATCH_RETURN();
 
+        // IStreamBuffer
+        bool GetBuffer(std::uint64_t offset, std::uint64_t size, const std::uint8_t** buffer) override
+        {
+            if (!m_streamBuffer || offset > m_size || size > (m_size - offset)) { return false; }
+            return m_streamBuffer->GetBuffer(m_offset + offset, size, buffer);
+        }
+
+        bool GetFileDescriptor(std::uint64_t offset, int* descriptor, std::uint64_t* descriptorOffset) override
+        {
+            if (!m_streamBuffer || offset > m_size) { return false; }
+            return m_streamBuffer->GetFileDescriptor(m_offset + offset, descriptor, descriptorOffset);
+        }
+
+        bool ReadAt(std::uint64_t offset, void* buffer, ULONG countBytes, ULONG* bytesRead) override
+        {
+            if (!m_streamBuffer) { return false; }
+            ULONG amountToRead = (offset < m_size) ? static_cast<ULONG>(std::min(static_cast<std::uint64_t>(countBytes), m_size - offset)) : 0;
+            return m_streamBuffer->ReadAt(m_offset + offset, buffer, amountToRead, bytesRead);
+        }
+
+        bool GetSize(std::uint64_t* size) override
+        {
+            *size = m_size;
+            return true;
+        }
+
         std::uint64_t Size() { return m_size; }
 
     protected:
@@ -70,5 +114,7 @@ namespace MSIX {
         std::uint64_t m_size;
         std::uint64_t m_relativePosition = 0;
         ComPtr<IStream> m_stream;
+        ComPtr<IStreamBuffer> m_streamBuffer;
+        std::shared_ptr<std::mutex> m_streamLock;
     };
 }
\ No newline at end of file
@@ -5,12 +5,32 @@
 #pragma once
 
 #include <vector>
+#include <memory>
+#include <utility>
+#include <cstdint>
 
 namespace MSIX {
 
     class SHA256
     {
     public:
+        // Incremental hashing: construct, call Update for each piece of the message in order and then
+        // FinalizeAndGetHashValue once. The object can't be reused afterwards.
+        SHA256();
+        ~SHA256();
+        void Update(const std::uint8_t* buffer, std::uint32_t cbBuffer);
+        void FinalizeAndGetHashValue(std::vector<std::uint8_t>& hash);
+
         static bool ComputeHash(std::uint8_t *buffer, std::uint32_t cbBuffer, std::vector<uint8_t>& hash);
+
+        // Hashes a batch of independent buffers, such as the blocks of a file. Uses the SHA extensions of x86-64
+        // processors when they are available, two buffers at a time, and ComputeHash otherwise.
+        typedef std::pair<const std::uint8_t*, std::uint32_t> Buffer;
+        static void ComputeHashes(const std::vector<Buffer>& buffers, std::vector<std::vector<std::uint8_t>>& hashes);
+
+    protected:
+        // Defined by each PAL
+        struct HashContext;
+        std::unique_ptr<HashContext> m_context;
     };
 }
\ No newline at end of file
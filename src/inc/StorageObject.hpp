@@ -45,7 +45,8 @@ class IStorageObject : public IUnknown
 public:        
     virtual const char* GetPathSeparator() = 0;
 
-    // Obtains a vector of UTF-8 formatted string names contained in the storage object
+    // Obtains a vector of UTF-8 formatted string names contained in the storage object. Storage objects
+    // over an archive return them in the order the files are stored, which is the cheapest order to read them.
     virtual std::vector<std::string> GetFileNames(FileNameOptions options) = 0;
 
     // Obtains a pointer to a stream representing the file that exists in the storage object
@@ -56,6 +57,10 @@ public:
     // then the file is created and an empty stream to the file is handed back to the caller.
     virtual MSIX::ComPtr<IStream> OpenFile(const std::string& fileName, MSIX::FileStream::Mode mode) = 0;
 
+    // Hints that the file is read soon, front to back. Storage objects over a file pass this on to the
+    // file system so it can read ahead; the others ignore it.
+    virtual void WillRead(const std::string& fileName) = 0;
+
     // Returns the file name of the storage object.
     virtual std::string GetFileName() = 0;
 };
@@ -14,6 +14,13 @@
 #include "AppxPackaging.hpp"
 #include "Exceptions.hpp"
 #include "ComHelper.hpp"
+#include "BufferPool.hpp"
+
+#ifdef LINUX
+#include <cerrno>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#endif
 
 EXTERN_C const IID IID_IStreamInternal;
 #ifndef WIN32
@@ -29,14 +36,47 @@ public:
     virtual std::uint64_t GetSizeOnZip() = 0;
     virtual bool IsCompressed() = 0;
     virtual std::string GetName() = 0;
+    // Gets the raw deflated bytes behind a decompressing stream, or nullptr if the stream isn't one.
+    virtual MSIX::ComPtr<IStream> GetCompressedStream() = 0;
 };
 
 SpecializeUuidOfImpl(IStreamInternal);
 
+EXTERN_C const IID IID_IStreamBuffer;
+#ifndef WIN32
+// {3a0b3541-5b94-47a7-9912-01bdd718a5a0}
+interface IStreamBuffer : public IUnknown
+#else
+class IStreamBuffer : public IUnknown
+#endif
+{
+public:
+    // Gets a read-only view of [offset, offset + size) of the stream without copying it. Returns false
+    // if the stream is not backed by memory and the bytes must be read. The view is valid for as long
+    // as the stream is alive.
+    virtual bool GetBuffer(std::uint64_t offset, std::uint64_t size, const std::uint8_t** buffer) = 0;
+    // Gets the file descriptor and the position in that file of the byte at offset of the stream, so the
+    // kernel can copy from or to it directly. Returns false if the stream isn't a plain file, or a range of
+    // one. Anything the stream buffered for writing is flushed first.
+    virtual bool GetFileDescriptor(std::uint64_t offset, int* descriptor, std::uint64_t* descriptorOffset) = 0;
+    // Reads up to countBytes at offset of the stream without using or moving its seek pointer, so it can be
+    // called from several threads at once. Returns false if the stream can't, in which case it has to be read
+    // by seeking it. Reading 0 bytes tells whether the stream can.
+    virtual bool ReadAt(std::uint64_t offset, void* buffer, ULONG countBytes, ULONG* bytesRead) = 0;
+    // Gets the size of the stream without using or moving its seek pointer. Returns false if the stream can't.
+    virtual bool GetSize(std::uint64_t* size) = 0;
+};
+
+SpecializeUuidOfImpl(IStreamBuffer);
+
 namespace MSIX {
-    class StreamBase : public MSIX::ComClass<StreamBase, IStream, IStreamInternal>
+    class StreamBase : public MSIX::ComClass<StreamBase, IStream, IStreamInternal, IStreamBuffer>
     {
     public:
+        // Buffer sizes used by CopyTo. The smallest is one blockmap block.
+        static const ULONGLONG MinCopyBufferSize = 64*1024;
+        static const ULONGLONG MaxCopyBufferSize = 1024*1024;
+
         // These are the same values as STREAM_SEEK. See 
         // https://msdn.microsoft.com/en-us/library/windows/desktop/aa380359(v=vs.85).aspx for additional details.
         enum Reference { START = SEEK_SET, CURRENT = SEEK_CUR, END = SEEK_END };
@@ -45,7 +85,9 @@ namespace MSIX {
 
         // IStream methods
         // Creates a new stream object with its own seek pointer that references the same bytes as the original stream.
-        virtual HRESULT STDMETHODCALLTYPE Clone(IStream**) noexcept override { return static_cast<HRESULT>(Error::NotSupported); }
+        // Streams that can ReadAt are cloned as a cursor over this stream, and their clones can be read from different
+        // threads at once. Other streams have to implement Clone themselves.
+        virtual HRESULT STDMETHODCALLTYPE Clone(IStream** stream) noexcept override;
 
         // Ensures that any changes made to a stream object open in transacted mode are reflected in the parent storage.
         // If the stream object is open in direct mode, IStream::Commit has no effect other than flushing all memory buffers
@@ -60,16 +102,83 @@ namespace MSIX {
             if (bytesWritten) { bytesWritten->QuadPart = 0; }
             ThrowErrorIf(Error::InvalidParameter, (nullptr == stream), "invalid parameter.");
 
-            static const ULONGLONG size = 1024;
-            std::vector<std::int8_t> bytes(size);
-            std::int64_t read = 0;
-            std::int64_t written = 0;
+            ULARGE_INTEGER start = { 0 };
+            ThrowHrIfFailed(Seek({0}, Reference::CURRENT, &start));
+            std::uint64_t read = 0;
+            std::uint64_t written = 0;
+
+            #ifdef LINUX
+            // If both streams are plain files, let the kernel copy the bytes. Streams that inflate or verify
+            // what they read never hand out a file descriptor.
+            int sourceDescriptor = -1;
+            std::uint64_t sourceOffset = 0;
+            ComPtr<IStreamBuffer> target;
+            if (GetFileDescriptor(start.QuadPart, &sourceDescriptor, &sourceOffset) &&
+                SUCCEEDED(stream->QueryInterface(UuidOfImpl<IStreamBuffer>::iid, reinterpret_cast<void**>(&target))))
+            {
+                ULARGE_INTEGER targetStart = { 0 };
+                ThrowHrIfFailed(stream->Seek({0}, Reference::CURRENT, &targetStart));
+                int targetDescriptor = -1;
+                std::uint64_t targetOffset = 0;
+                if (target->GetFileDescriptor(targetStart.QuadPart, &targetDescriptor, &targetOffset))
+                {
+                    ULARGE_INTEGER end = { 0 };
+                    ThrowHrIfFailed(Seek({0}, Reference::END, &end));
+                    std::uint64_t available = (end.QuadPart > start.QuadPart) ? std::min(bytesCount.QuadPart, end.QuadPart - start.QuadPart) : 0;
+                    read = written = CopyFileRange(sourceDescriptor, sourceOffset, targetDescriptor, targetOffset, available);
+                    bytesCount.QuadPart -= written;
+
+                    LARGE_INTEGER position = { 0 };
+                    position.QuadPart = start.QuadPart + written;
+                    ThrowHrIfFailed(Seek(position, Reference::START, nullptr));
+                    position.QuadPart = targetStart.QuadPart + written;
+                    ThrowHrIfFailed(stream->Seek(position, Reference::START, nullptr));
+                    start.QuadPart += written;
+                    if (written == available) { bytesCount.QuadPart = 0; }
+                }
+            }
+            #endif
+
+            // If the bytes are already in memory, write them straight from there. Only ask for the size of
+            // the stream if it can provide views, seeking to the end of a compressed stream is not cheap.
+            const std::uint8_t* view = nullptr;
+            if ((bytesCount.QuadPart != 0) && GetBuffer(start.QuadPart, 0, &view))
+            {
+                ULARGE_INTEGER end = { 0 };
+                ThrowHrIfFailed(Seek({0}, Reference::END, &end));
+                LARGE_INTEGER position = { 0 };
+                position.QuadPart = start.QuadPart;
+                ThrowHrIfFailed(Seek(position, Reference::START, nullptr));
+                std::uint64_t available = (end.QuadPart > start.QuadPart) ? std::min(bytesCount.QuadPart, end.QuadPart - start.QuadPart) : 0;
+                ThrowErrorIfNot(Error::FileRead, GetBuffer(start.QuadPart, available, &view), "unable to get stream buffer");
+
+                std::uint64_t copied = 0;
+                while (copied < available)
+                {
+                    ULONG copy = 0;
+                    ULONG chunk = static_cast<ULONG>(std::min(available - copied, static_cast<std::uint64_t>(std::numeric_limits<ULONG>::max())));
+                    ThrowHrIfFailed(stream->Write(reinterpret_cast<const void*>(view + copied), chunk, &copy));
+                    ThrowErrorIf(Error::FileWrite, (copy == 0), "write failed");
+                    copied += copy;
+                }
+                position.QuadPart = start.QuadPart + copied;
+                ThrowHrIfFailed(Seek(position, Reference::START, nullptr));
+                read += copied;
+                written += copied;
+                bytesCount.QuadPart = 0;
+            }
+
+            // Otherwise go through a buffer. It starts at the size of a blockmap block and doubles, up to
+            // MaxCopyBufferSize, for as long as the stream keeps filling it.
+            ULONGLONG size = MinCopyBufferSize;
+            BufferPool::Buffer bytes;
             ULONG length = 0;
 
             while (0 < bytesCount.QuadPart)
             {
-                ULONGLONG chunk = std::min(bytesCount.QuadPart, static_cast<ULONGLONG>(size));
-                ThrowHrIfFailed(Read(reinterpret_cast<void*>(bytes.data()), (ULONG)chunk, &length));
+                if (!bytes) { bytes = BufferPool::Get(static_cast<std::size_t>(size)); }
+                ULONGLONG chunk = std::min(bytesCount.QuadPart, size);
+                ThrowHrIfFailed(Read(reinterpret_cast<void*>(bytes->data()), (ULONG)chunk, &length));
                 if (length == 0) { break; }
                 read += length;
 
@@ -77,12 +186,18 @@ namespace MSIX {
                 while (0 < length)
                 {
                     ULONG copy = 0;
-                    ThrowHrIfFailed(stream->Write(reinterpret_cast<void*>(&bytes[offset]), length, &copy));
+                    ThrowHrIfFailed(stream->Write(reinterpret_cast<void*>(bytes->data() + offset), length, &copy));
                     offset += copy;
                     written += copy;
                     length -= copy;
                     bytesCount.QuadPart -= copy;
                 }
+
+                if ((offset == size) && (size < MaxCopyBufferSize) && (bytesCount.QuadPart > size))
+                {
+                    size *= 2;
+                    bytes.reset();
+                }
             }
 
             if (bytesRead)      { bytesRead->QuadPart = read; }
@@ -135,6 +250,13 @@ namespace MSIX {
         virtual std::uint64_t GetSizeOnZip() override { NOTIMPLEMENTED; }
         virtual bool IsCompressed() override { NOTIMPLEMENTED; }
         virtual std::string GetName() override { NOTIMPLEMENTED; }
+        virtual ComPtr<IStream> GetCompressedStream() override { return ComPtr<IStream>(); }
+
+        // IStreamBuffer
+        virtual bool GetBuffer(std::uint64_t, std::uint64_t, const std::uint8_t**) override { return false; }
+        virtual bool GetFileDescriptor(std::uint64_t, int*, std::uint64_t*) override { return false; }
+        virtual bool ReadAt(std::uint64_t, void*, ULONG, ULONG*) override { return false; }
+        virtual bool GetSize(std::uint64_t*) override { return false; }
 
         template <class T>
         static ULONG Read(const ComPtr<IStream>& stream, T* value)
@@ -145,6 +267,13 @@ namespace MSIX {
             return result;
         }
 
+        static void Read(const ComPtr<IStream>& stream, std::vector<std::uint8_t>& buffer)
+        {
+            ULONG result = 0;
+            ThrowHrIfFailed(stream->Read(buffer.data(), static_cast<ULONG>(buffer.size()), &result));
+            ThrowErrorIf(Error::FileRead, (result != buffer.size()), "Entire buffer wasn't read!");
+        }
+
         template <class T>
         static void Write(const ComPtr<IStream>& stream, T* value)
         {
@@ -152,5 +281,141 @@ namespace MSIX {
             ThrowHrIfFailed(stream->Write(value, static_cast<ULONG>(sizeof(T)), nullptr));
             ThrowErrorIf(Error::FileWrite, (result != sizeof(T)), "Entire object wasn't written!");
         }
+
+    protected:
+        #ifdef LINUX
+        // Copies up to size bytes between two files with copy_file_range, or with sendfile if the kernel or the
+        // file systems don't support it. Returns the number of bytes copied, which is 0 if neither can be used.
+        static std::uint64_t CopyFileRange(int source, std::uint64_t sourceOffset, int target, std::uint64_t targetOffset, std::uint64_t size)
+        {
+            static const std::uint64_t MaxChunk = 1 << 30;
+            loff_t in = static_cast<loff_t>(sourceOffset);
+            loff_t out = static_cast<loff_t>(targetOffset);
+            bool useSendFile = false;
+            std::uint64_t copied = 0;
+            while (copied < size)
+            {
+                std::size_t chunk = static_cast<std::size_t>(std::min(size - copied, MaxChunk));
+                ssize_t result = 0;
+                if (!useSendFile)
+                {
+                    result = copy_file_range(source, &in, target, &out, chunk, 0);
+                    if ((result < 0) && (copied == 0) && ((errno == EXDEV) || (errno == ENOSYS) || (errno == EINVAL) || (errno == EOPNOTSUPP)))
+                    {   // sendfile writes at the current position of the target
+                        ThrowErrorIf(Error::FileSeek, (lseek(target, out, SEEK_SET) == -1), "seek failed");
+                        useSendFile = true;
+                        continue;
+                    }
+                }
+                else
+                {
+                    off_t offset = static_cast<off_t>(in);
+                    result = sendfile(target, source, &offset, chunk);
+                    if ((result < 0) && (copied == 0) && ((errno == EINVAL) || (errno == ENOSYS)))
+                    {   return 0;
+                    }
+                    in = static_cast<loff_t>(offset);
+                }
+                ThrowErrorIf(Error::FileWrite, (result < 0), "copy failed");
+                if (result == 0) { break; }
+                copied += static_cast<std::uint64_t>(result);
+            }
+            return copied;
+        }
+        #endif
     };
+
+    // A seek pointer of its own over a stream that can ReadAt, see StreamBase::Clone.
+    class StreamCursor final : public StreamBase
+    {
+    public:
+        StreamCursor(const ComPtr<IStream>& stream, const ComPtr<IStreamBuffer>& streamBuffer, std::uint64_t size, std::uint64_t position) :
+            m_stream(stream), m_streamBuffer(streamBuffer), m_size(size), m_position(std::min(position, size))
+        {}
+
+        // IStream
+        HRESULT STDMETHODCALLTYPE Seek(LARGE_INTEGER move, DWORD origin, ULARGE_INTEGER* newPosition) noexcept override try
+        {
+            LARGE_INTEGER newPos = { 0 };
+            switch (origin)
+            {
+            case Reference::CURRENT:
+                newPos.QuadPart = static_cast<std::int64_t>(m_position) + move.QuadPart;
+                break;
+            case Reference::START:
+                newPos.QuadPart = move.QuadPart;
+                break;
+            case Reference::END:
+                newPos.QuadPart = static_cast<std::int64_t>(m_size) + move.QuadPart;
+                break;
+            default:
+                ThrowErrorAndLog(Error::FileSeek, "invalid seek origin");
+            }
+            ThrowErrorIf(Error::FileSeek, (newPos.QuadPart < 0), "seek failed");
+            m_position = std::min(static_cast<std::uint64_t>(newPos.QuadPart), m_size);
+            if (newPosition) { newPosition->QuadPart = m_position; }
+            return static_cast<HRESULT>(Error::OK);
+        } CATCH_RETURN();
+
+        HRESULT STDMETHODCALLTYPE Read(void* buffer, ULONG countBytes, ULONG* bytesRead) noexcept override try
+        {
+            ULONG amountRead = 0;
+            ThrowErrorIfNot(Error::FileRead, ReadAt(m_position, buffer, countBytes, &amountRead), "read failed");
+            m_position += amountRead;
+            if (bytesRead) { *bytesRead = amountRead; }
+            return static_cast<HRESULT>(Error::OK);
+        } CATCH_RETURN();
+
+        // IStreamInternal
+        std::uint64_t GetSizeOnZip() override { return m_stream.As<IStreamInternal>()->GetSizeOnZip(); }
+        bool IsCompressed() override { return m_stream.As<IStreamInternal>()->IsCompressed(); }
+        std::string GetName() override { return m_stream.As<IStreamInternal>()->GetName(); }
+
+        // IStreamBuffer
+        bool GetBuffer(std::uint64_t offset, std::uint64_t size, const std::uint8_t** buffer) override
+        {
+            return m_streamBuffer->GetBuffer(offset, size, buffer);
+        }
+
+        bool GetFileDescriptor(std::uint64_t offset, int* descriptor, std::uint64_t* descriptorOffset) override
+        {
+            return m_streamBuffer->GetFileDescriptor(offset, descriptor, descriptorOffset);
+        }
+
+        bool ReadAt(std::uint64_t offset, void* buffer, ULONG countBytes, ULONG* bytesRead) override
+        {
+            ULONG amountToRead = (offset < m_size) ? static_cast<ULONG>(std::min(static_cast<std::uint64_t>(countBytes), m_size - offset)) : 0;
+            return m_streamBuffer->ReadAt(offset, buffer, amountToRead, bytesRead);
+        }
+
+        bool GetSize(std::uint64_t* size) override
+        {
+            *size = m_size;
+            return true;
+        }
+
+    protected:
+        ComPtr<IStream>       m_stream;
+        ComPtr<IStreamBuffer> m_streamBuffer;
+        std::uint64_t         m_size;
+        std::uint64_t         m_position;
+    };
+
+    inline HRESULT STDMETHODCALLTYPE StreamBase::Clone(IStream** stream) noexcept try
+    {
+        ThrowErrorIf(Error::InvalidParameter, (stream == nullptr || *stream != nullptr), "bad pointer");
+        ULONG bytesRead = 0;
+        std::uint64_t size = 0;
+        ThrowErrorIfNot(Error::NotSupported, ReadAt(0, nullptr, 0, &bytesRead) && GetSize(&size), "stream can't be cloned");
+
+        // Only asks where the seek pointer is, so other threads cloning this stream at the same time are fine.
+        LARGE_INTEGER move = { 0 };
+        ULARGE_INTEGER position = { 0 };
+        ThrowHrIfFailed(Seek(move, Reference::CURRENT, &position));
+
+        ComPtr<IStream> self;
+        ThrowHrIfFailed(QueryInterface(UuidOfImpl<IStream>::iid, reinterpret_cast<void**>(&self)));
+        *stream = ComPtr<IStream>::Make<StreamCursor>(self, ComPtr<IStreamBuffer>(static_cast<IStreamBuffer*>(this)), size, position.QuadPart).Detach();
+        return static_cast<HRESULT>(Error::OK);
+    } CATCH_RETURN();
 }
\ No newline at end of file
@@ -45,6 +45,28 @@ namespace MSIX {
             return static_cast<HRESULT>(Error::OK);
         } CATCH_RETURN();
 
+        // IStreamBuffer
+        bool GetBuffer(std::uint64_t offset, std::uint64_t size, const std::uint8_t** buffer) override
+        {
+            if (offset > m_data->size() || size > (m_data->size() - offset)) { return false; }
+            *buffer = m_data->data() + offset;
+            return true;
+        }
+
+        bool ReadAt(std::uint64_t offset, void* buffer, ULONG countBytes, ULONG* bytesRead) override
+        {
+            ULONG amountToRead = (offset < m_data->size()) ? static_cast<ULONG>(std::min(static_cast<std::uint64_t>(countBytes), m_data->size() - offset)) : 0;
+            if (amountToRead > 0) { memcpy(buffer, m_data->data() + offset, amountToRead); }
+            if (bytesRead) { *bytesRead = amountToRead; }
+            return true;
+        }
+
+        bool GetSize(std::uint64_t* size) override
+        {
+            *size = m_data->size();
+            return true;
+        }
+
     protected:
         ULONG m_offset = 0;
         std::vector<std::uint8_t>* m_data;
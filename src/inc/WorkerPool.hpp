@@ -0,0 +1,138 @@
+//
+//  Copyright (C) 2017 Microsoft.  All rights reserved.
+//  See LICENSE file in the project root for full license information.
+//
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <cstddef>
+
+namespace MSIX {
+
+    // Runs the jobs of a parallel loop on one set of threads shared by the whole process, so nested users
+    // (Unpack extracting files, BlockMapStream inflating the blocks of one of them) don't each start their
+    // own threads. The thread that calls Run works on the jobs too.
+    class WorkerPool
+    {
+    public:
+        // Calls job(index) for every index below count and returns once all of them have finished. Once a job
+        // throws no more are started and the first error is rethrown here. Run called from inside a job runs
+        // its jobs inline on that thread, so a job never waits on the pool.
+        static void Run(std::size_t count, const std::function<void(std::size_t)>& job)
+        {
+            if ((count <= 1) || IsInJob())
+            {
+                InJob inJob;
+                for (std::size_t index = 0; index < count; index++) { job(index); }
+                return;
+            }
+
+            auto batch = std::make_shared<Batch>(count, job);
+            auto& pool = Instance();
+            {
+                std::lock_guard<std::mutex> lock(pool.m_lock);
+                for (std::size_t i = 0; i < std::min(count - 1, pool.m_threads); i++) { pool.m_queue.push_back(batch); }
+            }
+            pool.m_wake.notify_all();
+
+            batch->Work();
+            std::unique_lock<std::mutex> lock(batch->lock);
+            batch->finished.wait(lock, [&]() { return batch->done == batch->count; });
+            if (batch->firstError) { std::rethrow_exception(batch->firstError); }
+        }
+
+    protected:
+        struct InJob
+        {
+            InJob() : wasInJob(IsInJob()) { IsInJob() = true; }
+            ~InJob() { IsInJob() = wasInJob; }
+            bool wasInJob;
+        };
+
+        static bool& IsInJob()
+        {
+            static thread_local bool inJob = false;
+            return inJob;
+        }
+
+        // Shared with the pool threads, which may only get to it after Run returned. By then every index has
+        // been taken, so they leave without touching job.
+        struct Batch
+        {
+            Batch(std::size_t jobCount, const std::function<void(std::size_t)>& jobToRun) : count(jobCount), job(jobToRun) {}
+
+            void Work()
+            {
+                InJob inJob;
+                for (auto index = next++; index < count; index = next++)
+                {
+                    if (!failed)
+                    {
+                        try
+                        {   job(index);
+                        }
+                        catch (...)
+                        {
+                            std::lock_guard<std::mutex> guard(lock);
+                            if (!firstError) { firstError = std::current_exception(); }
+                            failed = true;
+                        }
+                    }
+                    std::lock_guard<std::mutex> guard(lock);
+                    if (++done == count) { finished.notify_all(); }
+                }
+            }
+
+            const std::size_t count;
+            const std::function<void(std::size_t)>& job;
+            std::atomic<std::size_t> next{0};
+            std::atomic<bool> failed{false};
+            std::size_t done = 0;
+            std::exception_ptr firstError;
+            std::mutex lock;
+            std::condition_variable finished;
+        };
+
+        WorkerPool() : m_threads(std::max(std::thread::hardware_concurrency(), 1u) - 1)
+        {
+            for (std::size_t i = 0; i < m_threads; i++)
+            {
+                std::thread([this]()
+                {
+                    while (true)
+                    {
+                        std::shared_ptr<Batch> batch;
+                        {
+                            std::unique_lock<std::mutex> lock(m_lock);
+                            m_wake.wait(lock, [this]() { return !m_queue.empty(); });
+                            batch = std::move(m_queue.front());
+                            m_queue.pop_front();
+                        }
+                        batch->Work();
+                    }
+                }).detach();
+            }
+        }
+
+        // Never destroyed. Joining threads while the library is unloaded can deadlock on Windows.
+        static WorkerPool& Instance()
+        {
+            static WorkerPool* pool = new WorkerPool();
+            return *pool;
+        }
+
+        std::size_t m_threads;
+        std::mutex m_lock;
+        std::condition_variable m_wake;
+        std::deque<std::shared_ptr<Batch>> m_queue;
+    };
+}
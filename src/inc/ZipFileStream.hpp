@@ -10,6 +10,8 @@
 #include "AppxFactory.hpp"
 
 #include <string>
+#include <memory>
+#include <mutex>
 
 namespace MSIX {
 
@@ -25,8 +27,9 @@ namespace MSIX {
             bool isCompressed,
             std::uint64_t offset,
             std::uint64_t size,
-            const ComPtr<IStream>& stream
-        ) : m_isCompressed(isCompressed), RangeStream(offset, size, stream), m_name(name), m_contentType(contentType), m_factory(factory), m_compressedSize(size)
+            const ComPtr<IStream>& stream,
+            const std::shared_ptr<std::mutex>& streamLock = nullptr
+        ) : m_isCompressed(isCompressed), RangeStream(offset, size, stream, streamLock), m_name(name), m_contentType(contentType), m_factory(factory), m_compressedSize(size)
         {
         }
 
@@ -13,24 +13,58 @@
 #include <vector>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <functional>
+#include <cstdint>
 
 namespace MSIX {
+    // Compact central directory record. This is all that is kept for each entry of the zip
+    // until the file is requested, at which point the local file header is read.
+    struct ZipCentralDirectoryEntry
+    {
+        std::uint64_t localHeaderOffset      = 0;
+        std::uint64_t compressedSize         = 0;
+        std::uint64_t uncompressedSize       = 0;
+        bool          isGeneralPurposeBitSet = false;
+    };
+
     // This represents a raw stream over a.zip file.
     class ZipObject final : public ComClass<ZipObject, IStorageObject>
     {
     public:
         ZipObject(IMsixFactory* factory, const ComPtr<IStream>& stream);
 
+        // Reads the zip front to back from a stream that can't seek, as it arrives. Each file is handed to
+        // onFile with a stream over its uncompressed bytes, which can only be read during the call. If onFile
+        // returns false without reading it, the file is kept in memory and GetFile works for it as for any
+        // zip. The files onFile did read are listed, but can't be read again. Once the central directory is
+        // reached it is checked against the local file headers that were read.
+        typedef std::function<bool(const std::string& fileName, const ComPtr<IStream>& stream)> FileVisitor;
+        ZipObject(IMsixFactory* factory, const ComPtr<IStream>& stream, const FileVisitor& onFile);
+
         // IStorageObject methods
         const char* GetPathSeparator() override { return "/"; }
         std::vector<std::string> GetFileNames(FileNameOptions options) override;
         ComPtr<IStream> GetFile(const std::string& fileName) override;
         ComPtr<IStream> OpenFile(const std::string& fileName, MSIX::FileStream::Mode mode) override { NOTIMPLEMENTED; }
+        void WillRead(const std::string& fileName) override;
         std::string GetFileName() override;
 
     protected:
-        IMsixFactory*                          m_factory;
-        ComPtr<IStream>                        m_stream;
-        std::map<std::string, ComPtr<IStream>> m_streams;
+        IMsixFactory*                                   m_factory;
+        ComPtr<IStream>                                 m_stream;
+        std::map<std::string, ZipCentralDirectoryEntry> m_centralDirectory;
+        // The names of m_centralDirectory in the order of their local file headers.
+        std::vector<std::string>                        m_fileNames;
+        std::map<std::string, ComPtr<IStream>>          m_streams;
+        std::mutex                                      m_streamsLock;
+        // Guards m_stream's seek pointer, which is shared by all the files of the zip, if it can't ReadAt.
+        std::shared_ptr<std::mutex>                     m_streamLock = std::make_shared<std::mutex>();
+        // Files kept when the zip was read front to back, see FileVisitor.
+        std::map<std::string, std::vector<std::uint8_t>> m_keptFiles;
+        // The file the zip is stored in, if it is one, for read ahead hints.
+        int                                             m_descriptor = -1;
+        std::uint64_t                                   m_descriptorOffset = 0;
     };//class ZipObject
 }
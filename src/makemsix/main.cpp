@@ -41,6 +41,24 @@ struct State
         return true;
     }
 
+    bool UnpackInParallel()
+    {
+        unpackOptions = static_cast<MSIX_PACKUNPACK_OPTION>(unpackOptions | MSIX_PACKUNPACK_OPTION::MSIX_PACKUNPACK_OPTION_UNPACKINPARALLEL);
+        return true;
+    }
+
+    bool UnbufferedWrites()
+    {
+        unpackOptions = static_cast<MSIX_PACKUNPACK_OPTION>(unpackOptions | MSIX_PACKUNPACK_OPTION::MSIX_PACKUNPACK_OPTION_UNBUFFEREDWRITES);
+        return true;
+    }
+
+    bool ReadForwardOnly()
+    {
+        unpackOptions = static_cast<MSIX_PACKUNPACK_OPTION>(unpackOptions | MSIX_PACKUNPACK_OPTION::MSIX_PACKUNPACK_OPTION_READFORWARDONLY);
+        return true;
+    }
+
     bool SkipManifestValidation()
     {
         validationOptions = static_cast<MSIX_VALIDATION_OPTION>(validationOptions | MSIX_VALIDATION_OPTION::MSIX_VALIDATION_OPTION_SKIPAPPXMANIFEST);
@@ -302,6 +320,12 @@ int main(int argc, char* argv[])
                     [](State& state, const std::string& name) { return state.SetDirectoryName(name); }),
                 Option("-pfn", false, "Unpacks all files to a subdirectory under the specified output path, named after the package full name.",
                     [](State& state, const std::string&) {return state.CreatePackageSubfolder(); }),
+                Option("-mt", false, "Unpacks the files of the package concurrently using all available processors.",
+                    [](State& state, const std::string&) { return state.UnpackInParallel(); }),
+                Option("-dio", false, "Writes large files past the file system cache, where supported.",
+                    [](State& state, const std::string&) { return state.UnbufferedWrites(); }),
+                Option("-fo", false, "Reads the package front to back in one pass, for input that can't seek such as a pipe. Files are moved into place once the package is validated.",
+                    [](State& state, const std::string&) { return state.ReadForwardOnly(); }),
                 Option("-mv", false, "Skips manifest validation.  By default manifest validation is enabled.",
                     [](State& state, const std::string&) { return state.SkipManifestValidation(); }),
                 Option("-sv", false, "Skips signature validation.  By default signature validation is enabled.",
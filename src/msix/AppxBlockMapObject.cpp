@@ -45,78 +45,152 @@ namespace MSIX {
             result.blockSize = sizeAttr;
             result.compressedSize = sizeAttr;
         }
-        result.hash = element->GetBase64DecodedAttributeValue(XmlAttributeName::BlockMap_File_Block_Hash);
+        ThrowErrorIfNot(Error::BlockMapSemanticError,
+            element->GetBase64DecodedAttributeValue(XmlAttributeName::BlockMap_File_Block_Hash, result.hash.data(), result.hash.size()),
+            "Block hash is not a SHA256 digest");
         return result;
     }
 
-    AppxBlockMapObject::AppxBlockMapObject(IMsixFactory* factory, const ComPtr<IStream>& stream) : m_factory(factory), m_stream(stream)
+    // Picks the same elements as the /BlockMap/File and ./Block queries out of the elements of the blockmap.
+    class AppxBlockMapObject::ElementHandler final : public XmlElementHandler
     {
-        ComPtr<IXmlFactory> xmlFactory;
-        ThrowHrIfFailed(factory->QueryInterface(UuidOfImpl<IXmlFactory>::iid, reinterpret_cast<void**>(&xmlFactory)));
-        auto dom = xmlFactory->CreateDomFromStream(XmlContentType::AppxBlockMapXml, stream);
+    public:
+        ElementHandler(AppxBlockMapObject* self) : m_self(self) {}
 
-        struct _context
+        void StartElement(std::size_t depth, const std::string& name, const ComPtr<IXmlElement>& element) override
         {
-            AppxBlockMapObject* self;
-            IMsixFactory*       factory;
-            size_t              countFilesFound;
-            IXmlDom*            dom;
-        };
-        _context context = { this, factory, 0, dom.Get() };
-
-        XmlVisitor visitor(static_cast<void*>(&context), [](void* c, const ComPtr<IXmlElement>& fileNode)->bool
+            if (depth == 0)
+            {   m_isBlockMap = (name == "BlockMap");
+            }
+            else if (m_isBlockMap && (depth == 1) && (name == "File"))
+            {   m_self->StartFile(element);
+                m_isInFile = true;
+            }
+            else if (m_isInFile && (depth == 2) && (name == "Block"))
+            {   m_self->AddBlock(element);
+            }
+        }
+
+        void EndElement(std::size_t depth, const std::string& name) override
         {
-            const auto& name = fileNode->GetAttributeValue(XmlAttributeName::Name);
-            ThrowErrorIf(Error::BlockMapSemanticError, (name == "[Content_Types].xml"), "[Content_Types].xml cannot be in the AppxBlockMap.xml file");
+            if (m_isInFile && (depth == 1))
+            {   m_self->EndFile();
+                m_isInFile = false;
+            }
+        }
 
-            _context* context = reinterpret_cast<_context*>(c);
-            std::ostringstream builder;
-            builder << "Duplicate file: '" << name << "' specified in AppxBlockMap.xml.";
-            ThrowErrorIf(Error::BlockMapSemanticError, (context->self->m_blockMap.find(name) != context->self->m_blockMap.end()), builder.str().c_str());
+    protected:
+        AppxBlockMapObject* m_self;
+        bool m_isBlockMap = false;
+        bool m_isInFile = false;
+    };
+
+    AppxBlockMapObject::AppxBlockMapObject(IMsixFactory* factory, const ComPtr<IStream>& stream) : m_factory(factory), m_stream(stream)
+    {
+        ComPtr<IXmlFactory> xmlFactory;
+        ThrowHrIfFailed(factory->QueryInterface(UuidOfImpl<IXmlFactory>::iid, reinterpret_cast<void**>(&xmlFactory)));
 
-            std::uint64_t sizeAttribute = GetNumber<std::uint64_t>(fileNode, XmlAttributeName::Size, BLOCKMAP_BLOCK_SIZE);
+        // The blockmap of a large package is tens of MB of xml, so it's parsed as it's read when the parser can,
+        // rather than into a DOM.
+        ElementHandler handler(this);
+        if (!xmlFactory->ParseFromStream(XmlContentType::AppxBlockMapXml, stream, handler))
+        {
+            auto dom = xmlFactory->CreateDomFromStream(XmlContentType::AppxBlockMapXml, stream);
 
-            std::vector<Block> blocks;
-            struct _contextBlock
+            struct _context
             {
-                std::vector<Block>* blocks;
-                std::uint64_t fallbackSize;
+                AppxBlockMapObject* self;
+                IXmlDom*            dom;
             };
-            _contextBlock contextBlock = { &blocks, sizeAttribute};
-            XmlVisitor visitor(static_cast<void*>(&contextBlock), [](void* c, const ComPtr<IXmlElement>& blockNode)->bool
+            _context context = { this, dom.Get() };
+
+            XmlVisitor visitor(static_cast<void*>(&context), [](void* c, const ComPtr<IXmlElement>& fileNode)->bool
             {
-                _contextBlock* contextBlock = reinterpret_cast<_contextBlock*>(c);
-                contextBlock->blocks->push_back(GetBlock(blockNode, contextBlock->fallbackSize));
+                _context* context = reinterpret_cast<_context*>(c);
+                context->self->StartFile(fileNode);
+                XmlVisitor visitor(static_cast<void*>(context->self), [](void* c, const ComPtr<IXmlElement>& blockNode)->bool
+                {
+                    reinterpret_cast<AppxBlockMapObject*>(c)->AddBlock(blockNode);
+                    return true;
+                });
+                context->dom->ForEachElementIn(fileNode, XmlQueryName::BlockMap_File_Block, visitor);
+                context->self->EndFile();
                 return true;
             });
-            context->dom->ForEachElementIn(fileNode, XmlQueryName::BlockMap_File_Block, visitor);
-
-            ThrowErrorIf(Error::BlockMapSemanticError, (0 == blocks.size() && 0 != sizeAttribute), "If size is non-zero, then there must be 1+ blocks.");
-
-            context->self->m_blockMap.insert(std::make_pair(name, std::move(blocks)));
-            context->self->m_blockMapFiles.insert(std::make_pair(name,
-                ComPtr<IAppxBlockMapFile>::Make<AppxBlockMapFile>(
-                    context->factory,
-                    &(context->self->m_blockMap[name]),
-                    GetNumber<std::uint32_t>(fileNode, XmlAttributeName::BlockMap_File_LocalFileHeaderSize, 0),
-                    name,
-                    sizeAttribute
-                )));
-            context->countFilesFound++;
-            return true;
-        });
-        dom->ForEachElementIn(dom->GetDocument(), XmlQueryName::BlockMap_File, visitor);
-        ThrowErrorIf(Error::XmlError, (0 == context.countFilesFound), "Empty AppxBlockMap.xml");
+            dom->ForEachElementIn(dom->GetDocument(), XmlQueryName::BlockMap_File, visitor);
+        }
+        ThrowErrorIf(Error::XmlError, m_files.empty(), "Empty AppxBlockMap.xml");
+
+        std::stable_sort(m_files.begin(), m_files.end(), [](const FileEntry& a, const FileEntry& b) { return a.name < b.name; });
+        auto duplicate = std::adjacent_find(m_files.begin(), m_files.end(), [](const FileEntry& a, const FileEntry& b) { return a.name == b.name; });
+        if (duplicate != m_files.end())
+        {
+            std::ostringstream builder;
+            builder << "Duplicate file: '" << duplicate->name << "' specified in AppxBlockMap.xml.";
+            ThrowErrorAndLog(Error::BlockMapSemanticError, builder.str().c_str());
+        }
+    }
+
+    void AppxBlockMapObject::StartFile(const ComPtr<IXmlElement>& fileNode)
+    {
+        const auto& name = fileNode->GetAttributeValue(XmlAttributeName::Name);
+        ThrowErrorIf(Error::BlockMapSemanticError, (name == "[Content_Types].xml"), "[Content_Types].xml cannot be in the AppxBlockMap.xml file");
+
+        // The blocks of every file go in the same vector, the file only remembers where its own are.
+        FileEntry entry;
+        entry.name                = name;
+        entry.firstBlock          = m_blocks.size();
+        entry.blockCount          = 0;
+        entry.localFileHeaderSize = GetNumber<std::uint32_t>(fileNode, XmlAttributeName::BlockMap_File_LocalFileHeaderSize, 0);
+        entry.uncompressedSize    = GetNumber<std::uint64_t>(fileNode, XmlAttributeName::Size, BLOCKMAP_BLOCK_SIZE);
+        m_files.push_back(std::move(entry));
+    }
+
+    void AppxBlockMapObject::AddBlock(const ComPtr<IXmlElement>& blockNode)
+    {
+        auto& entry = m_files.back();
+        m_blocks.push_back(GetBlock(blockNode, entry.uncompressedSize));
+        entry.blockCount++;
+    }
+
+    void AppxBlockMapObject::EndFile()
+    {
+        const auto& entry = m_files.back();
+        ThrowErrorIf(Error::BlockMapSemanticError, (entry.blockCount == 0 && 0 != entry.uncompressedSize), "If size is non-zero, then there must be 1+ blocks.");
+    }
+
+    AppxBlockMapObject::FileEntry* AppxBlockMapObject::FindFile(const std::string& fileName)
+    {
+        auto entry = std::lower_bound(m_files.begin(), m_files.end(), fileName, [](const FileEntry& a, const std::string& name) { return a.name < name; });
+        return ((entry != m_files.end()) && (entry->name == fileName)) ? &(*entry) : nullptr;
+    }
+
+    ComPtr<IAppxBlockMapFile> AppxBlockMapObject::GetFile(FileEntry& entry)
+    {   // The block map can be shared between threads, which may ask for the same file at once.
+        std::lock_guard<std::mutex> lock(m_filesLock);
+        if (!entry.file)
+        {
+            entry.file = ComPtr<IAppxBlockMapFile>::Make<AppxBlockMapFile>(m_factory, GetBlocks(entry), entry.localFileHeaderSize, entry.name, entry.uncompressedSize);
+        }
+        return entry.file;
+    }
+
+    BlockSpan AppxBlockMapObject::GetBlocks(const FileEntry& entry)
+    {
+        BlockSpan blocks;
+        blocks.data  = m_blocks.data() + entry.firstBlock;
+        blocks.count = entry.blockCount;
+        return blocks;
     }
 
     ComPtr<IStream> AppxBlockMapObject::GetValidationStream(const std::string& part, const ComPtr<IStream>& stream)
     {
         ThrowErrorIf(Error::InvalidParameter, (part.empty() || !stream), "bad input");
-        auto item = m_blockMap.find(part);
+        auto entry = FindFile(part);
         std::ostringstream builder;
         builder << "file: '" << part << "' not tracked by blockmap.";
-        ThrowErrorIf(Error::BlockMapSemanticError, item == m_blockMap.end(), builder.str().c_str());
-        return ComPtr<IStream>::Make<BlockMapStream>(m_factory, part, stream, item->second);
+        ThrowErrorIf(Error::BlockMapSemanticError, entry == nullptr, builder.str().c_str());
+        return ComPtr<IStream>::Make<BlockMapStream>(m_factory, part, stream, GetBlocks(*entry));
     }
 
     HRESULT STDMETHODCALLTYPE AppxBlockMapObject::GetFile(LPCWSTR filename, IAppxBlockMapFile **file) noexcept try
@@ -124,10 +198,9 @@ namespace MSIX {
         ThrowErrorIf(Error::InvalidParameter, (
             filename == nullptr || *filename == '\0' || file == nullptr || *file != nullptr
         ), "bad pointer");
-        auto blockMapFile = m_blockMapFiles.find(utf16_to_utf8(filename));
-        ThrowErrorIf(Error::InvalidParameter, (blockMapFile == m_blockMapFiles.end()), "File not found!");
-        MSIX::ComPtr<IAppxBlockMapFile> result = blockMapFile->second;
-        *file = result.Detach();
+        auto entry = FindFile(utf16_to_utf8(filename));
+        ThrowErrorIf(Error::InvalidParameter, (entry == nullptr), "File not found!");
+        *file = GetFile(*entry).Detach();
         return static_cast<HRESULT>(Error::OK);
     } CATCH_RETURN();
 
@@ -135,10 +208,9 @@ namespace MSIX {
     {
         ThrowErrorIf(Error::InvalidParameter, (enumerator == nullptr || *enumerator != nullptr), "bad pointer");
         std::vector<ComPtr<IAppxBlockMapFile>> blockMapFiles;
-        for(const auto& file : m_blockMapFiles)
+        for(auto& entry : m_files)
         {
-            auto blockFile = file.second;
-            blockMapFiles.push_back(std::move(blockFile));
+            blockMapFiles.push_back(GetFile(entry));
         }
         *enumerator = ComPtr<IAppxBlockMapFilesEnumerator>::
                 Make<EnumeratorCom<IAppxBlockMapFilesEnumerator, IAppxBlockMapFile>>(blockMapFiles).Detach();
@@ -165,25 +237,25 @@ namespace MSIX {
     {
         std::vector<std::string> fileNames;
         std::transform(
-            m_blockMapFiles.begin(),
-            m_blockMapFiles.end(),
+            m_files.begin(),
+            m_files.end(),
             std::back_inserter(fileNames),
-            [](auto keyValuePair){ return keyValuePair.first; }
+            [](const FileEntry& entry){ return entry.name; }
         );
         return fileNames;
     }
 
-    std::vector<Block> AppxBlockMapObject::GetBlocks(const std::string& fileName)
+    BlockSpan AppxBlockMapObject::GetBlocks(const std::string& fileName)
     {
-        auto index = m_blockMap.find(fileName);
-        ThrowErrorIf(Error::FileNotFound, (index == m_blockMap.end()), "File not in blockmap");
-        return index->second;
+        auto entry = FindFile(fileName);
+        ThrowErrorIf(Error::FileNotFound, (entry == nullptr), "File not in blockmap");
+        return GetBlocks(*entry);
     }
 
     ComPtr<IAppxBlockMapFile> AppxBlockMapObject::GetFile(const std::string& fileName)
     {
-        auto index = m_blockMapFiles.find(fileName);
-        ThrowErrorIf(Error::FileNotFound, (index == m_blockMapFiles.end()), "File not in blockmap");
-        return index->second;
+        auto entry = FindFile(fileName);
+        ThrowErrorIf(Error::FileNotFound, (entry == nullptr), "File not in blockmap");
+        return GetFile(*entry);
     }
 }
\ No newline at end of file
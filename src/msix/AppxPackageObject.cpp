@@ -15,6 +15,9 @@
 #include "Encoding.hpp"
 #include "Enumerators.hpp"
 #include "AppxFile.hpp"
+#include "SHA256.hpp"
+#include "BufferPool.hpp"
+#include "WorkerPool.hpp"
 
 #ifdef BUNDLE_SUPPORT
 #include "Applicability.hpp"
@@ -24,10 +27,12 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <set>
 #include <memory>
 #include <limits>
 #include <algorithm>
 #include <array>
+#include <cstring>
 
 namespace MSIX {
 
@@ -406,48 +411,233 @@ namespace MSIX {
 
     void AppxPackageObject::Unpack(MSIX_PACKUNPACK_OPTION options, const ComPtr<IStorageObject>& to)
     {
-        auto fileNames = GetFileNames(FileNameOptions::All);
-        for (const auto& fileName : fileNames)
+        std::set<std::string> filesToUnpack;
+        for (const auto& fileName : GetFileNames(FileNameOptions::All))
         {   // Don't extract packages files
             auto file = std::find(std::begin(m_applicablePackagesNames), std::end(m_applicablePackagesNames), fileName);
             if (file == std::end(m_applicablePackagesNames))
-            {
-                std::string targetName;
-                if (options & MSIX_PACKUNPACK_OPTION_CREATEPACKAGESUBFOLDER)
-                {   // Don't use to->GetPathSeparator(). DirectoryObject::OpenFile created directories
-                    // by looking at "/" in the string. If to->GetPathSeparator() is used the subfolder with
-                    // the package full name won't be created on Windows, but it will on other platforms.
-                    // This means that we have different behaviors in non-Win platforms.
-                    auto manifest = m_appxManifest.As<IAppxManifestReader>();
-                    ComPtr<IAppxManifestPackageId> packageId;
-                    ThrowHrIfFailed(manifest->GetPackageId(&packageId));
-                    targetName = packageId.As<IAppxManifestPackageIdInternal>()->GetPackageFullName() + "/" + fileName;
-                }
-                else
-                {   targetName = DecodeFileName(fileName);
-                }
+            {   filesToUnpack.insert(fileName);
+            }
+        }
 
-                auto targetFile = to->OpenFile(targetName, MSIX::FileStream::Mode::WRITE_UPDATE);
-                auto sourceFile = GetFile(fileName).As<IStream>();
+        // Extract the files in the order they are stored in the container, so the package is read front to
+        // back in one pass instead of jumping around it in name order.
+        std::vector<std::string> fileNames;
+        for (const auto& fileName : m_container->GetFileNames(FileNameOptions::All))
+        {
+            if (filesToUnpack.erase(fileName) != 0) { fileNames.push_back(fileName); }
+        }
+        fileNames.insert(fileNames.end(), filesToUnpack.begin(), filesToUnpack.end());
 
-                ULARGE_INTEGER bytesCount = {0};
-                bytesCount.QuadPart = std::numeric_limits<std::uint64_t>::max();
-                ThrowHrIfFailed(sourceFile->CopyTo(targetFile.Get(), bytesCount, nullptr, nullptr));
+        std::string packageFullName;
+        if (options & MSIX_PACKUNPACK_OPTION_CREATEPACKAGESUBFOLDER)
+        {
+            auto manifest = m_appxManifest.As<IAppxManifestReader>();
+            ComPtr<IAppxManifestPackageId> packageId;
+            ThrowHrIfFailed(manifest->GetPackageId(&packageId));
+            packageFullName = packageId.As<IAppxManifestPackageIdInternal>()->GetPackageFullName();
+        }
+
+        // Files are handed out in order, so the container is told about the next few while one is extracted.
+        const std::size_t ReadAheadFiles = 4;
+        for (std::size_t index = 0; index < std::min(ReadAheadFiles, fileNames.size()); index++)
+        {   m_container->WillRead(fileNames[index]);
+        }
+
+        auto unpackFile = [&](std::size_t index)
+        {
+            if (index + ReadAheadFiles < fileNames.size()) { m_container->WillRead(fileNames[index + ReadAheadFiles]); }
+
+            const auto& fileName = fileNames[index];
+            std::string targetName;
+            if (options & MSIX_PACKUNPACK_OPTION_CREATEPACKAGESUBFOLDER)
+            {   // Don't use to->GetPathSeparator(). DirectoryObject::OpenFile created directories
+                // by looking at "/" in the string. If to->GetPathSeparator() is used the subfolder with
+                // the package full name won't be created on Windows, but it will on other platforms.
+                // This means that we have different behaviors in non-Win platforms.
+                targetName = packageFullName + "/" + fileName;
+            }
+            else
+            {   targetName = DecodeFileName(fileName);
+            }
+
+            auto targetFile = to->OpenFile(targetName, MSIX::FileStream::Mode::WRITE);
+            auto sourceFile = GetFile(fileName).As<IStream>();
+
+            // Let the target reserve the space of the whole file up front. Not every target can, so
+            // a failure here is ignored.
+            ULARGE_INTEGER size = {0};
+            ThrowHrIfFailed(GetAppxFile(fileName)->GetSize(&size.QuadPart));
+            targetFile->SetSize(size);
+
+            ULARGE_INTEGER bytesCount = {0};
+            bytesCount.QuadPart = std::numeric_limits<std::uint64_t>::max();
+            ThrowHrIfFailed(sourceFile->CopyTo(targetFile.Get(), bytesCount, nullptr, nullptr));
+            ThrowHrIfFailed(targetFile->Commit(0));
+        };
+
+        if (options & MSIX_PACKUNPACK_OPTION_UNPACKINPARALLEL)
+        {   // Every file has its own stream stack, so workers only share the container, whose seek pointer
+            // is guarded by the zip object. The blocks of each file are inflated on the worker that has it.
+            WorkerPool::Run(fileNames.size(), unpackFile);
+        }
+        else
+        {
+            for (std::size_t index = 0; index < fileNames.size(); index++)
+            {   unpackFile(index);
             }
         }
 
 #ifdef BUNDLE_SUPPORT
         if(m_isBundle)
-        {
+        {   // All the files of a package in the bundle are read through the one stream of the package
+            // in the bundle, which can't be shared between workers, so they are unpacked serially.
+            auto packageOptions = static_cast<MSIX_PACKUNPACK_OPTION>(
+                (options | MSIX_PACKUNPACK_OPTION_CREATEPACKAGESUBFOLDER) & ~MSIX_PACKUNPACK_OPTION_UNPACKINPARALLEL);
             for(const auto& appx : m_applicablePackages)
             {
-                appx.As<IPackage>()->Unpack(
-                    static_cast<MSIX_PACKUNPACK_OPTION>(options | MSIX_PACKUNPACK_OPTION_CREATEPACKAGESUBFOLDER), to.Get());
+                appx.As<IPackage>()->Unpack(packageOptions, to.Get());
             }
         }
 #endif
     }
 
+    // Files unpacked from a stream are written before the package is validated, so their names have to stay
+    // under the target: relative, no backslashes, drives, "." or ".." segments, and not in the staging directory.
+    static bool IsSafeTargetName(const std::string& name, const std::string& stagingDirectory)
+    {
+        if (name.empty() || (name.find_first_of("\\:") != std::string::npos)) { return false; }
+        std::size_t start = 0;
+        while (true)
+        {
+            auto end = name.find('/', start);
+            auto segment = name.substr(start, (end == std::string::npos) ? std::string::npos : end - start);
+            if (segment.empty() || (segment == ".") || (segment == "..") || ((start == 0) && (segment == stagingDirectory)))
+            {   return false;
+            }
+            if (end == std::string::npos) { return true; }
+            start = end + 1;
+        }
+    }
+
+    void AppxPackageObject::UnpackFromStream(IMsixFactory* factory, MSIX_VALIDATION_OPTION validation, MSIX_PACKUNPACK_OPTION options,
+        const ComPtr<IStream>& stream, const ComPtr<DirectoryObject>& to)
+    {
+        ThrowErrorIf(Error::NotSupported, (options & MSIX_PACKUNPACK_OPTION_CREATEPACKAGESUBFOLDER),
+            "package subfolder can't be created when unpacking from a stream that can't seek");
+
+        // The footprint files come last and are needed to validate the package, so they are kept by the zip.
+        static const char* const footprintFileNames[] = {
+            APPXBLOCKMAP_XML, APPXMANIFEST_XML, APPXSIGNATURE_P7X, CODEINTEGRITY_CAT, CONTENT_TYPES_XML, APPXBUNDLEMANIFEST_XML };
+
+        struct UnpackedFile
+        {
+            std::uint64_t size = 0;
+            std::vector<std::vector<std::uint8_t>> hashes;
+        };
+        std::map<std::string, UnpackedFile> unpackedFiles;
+
+        // Payload files are written to the staging directory, named by the order they arrive in, and only moved
+        // to their own names once the package is validated.
+        const std::string stagingDirectory = ".msixstaging";
+        std::vector<std::pair<std::string, std::string>> stagedFiles;
+
+        auto onFile = [&](const std::string& fileName, const ComPtr<IStream>& fileStream)
+        {
+            if (std::find(std::begin(footprintFileNames), std::end(footprintFileNames), fileName) != std::end(footprintFileNames))
+            {   return false;
+            }
+
+            auto targetName = DecodeFileName(fileName);
+            ThrowErrorIfNot(Error::ZipLocalFileHeader, IsSafeTargetName(targetName, stagingDirectory), "file name escapes the target directory");
+            ThrowErrorIf(Error::ZipLocalFileHeader, (unpackedFiles.find(fileName) != unpackedFiles.end()), "file is in the package twice");
+            auto& unpacked = unpackedFiles[fileName];
+            stagedFiles.emplace_back(stagingDirectory + "/" + std::to_string(stagedFiles.size()), std::move(targetName));
+            auto targetFile = to->OpenFile(stagedFiles.back().first, MSIX::FileStream::Mode::WRITE);
+            auto block = BufferPool::Get(static_cast<std::size_t>(BLOCKMAP_BLOCK_SIZE));
+            while (true)
+            {
+                ULONG blockSize = 0;
+                ULONG bytesRead = 0;
+                do
+                {
+                    ThrowHrIfFailed(fileStream->Read(block->data() + blockSize, static_cast<ULONG>(block->size()) - blockSize, &bytesRead));
+                    blockSize += bytesRead;
+                } while ((bytesRead != 0) && (blockSize < block->size()));
+                if (blockSize == 0) { break; }
+
+                std::vector<std::uint8_t> hash;
+                ThrowErrorIfNot(Error::SignatureInvalid, SHA256::ComputeHash(block->data(), blockSize, hash), "Invalid signature");
+                unpacked.hashes.push_back(std::move(hash));
+                unpacked.size += blockSize;
+
+                ULONG bytesWritten = 0;
+                ThrowHrIfFailed(targetFile->Write(block->data(), blockSize, &bytesWritten));
+                ThrowErrorIf(Error::FileWrite, (bytesWritten != blockSize), "write failed");
+            }
+            ThrowHrIfFailed(targetFile->Commit(0));
+            return true;
+        };
+
+        try
+        {
+            // Reading the package validates the signature, the footprint files and the sizes of the payload files.
+            auto container = ComPtr<IStorageObject>::Make<ZipObject>(factory, stream, onFile);
+            auto package = ComPtr<IPackage>::Make<AppxPackageObject>(factory, validation, MSIX_APPLICABILITY_OPTION_FULL, container);
+            auto self = static_cast<AppxPackageObject*>(package.Get());
+            ThrowErrorIf(Error::NotSupported, self->m_isBundle, "bundles can't be unpacked from a stream that can't seek");
+
+            auto blockMapInternal = self->m_appxBlockMap.As<IAppxBlockMapInternal>();
+            for (const auto& blockMapName : blockMapInternal->GetFileNames())
+            {
+                if (std::find(std::begin(footprintFileNames), std::end(footprintFileNames), blockMapName) != std::end(footprintFileNames))
+                {   continue;
+                }
+                auto unpacked = unpackedFiles.find(EncodeFileName(blockMapName));
+                ThrowErrorIf(Error::FileNotFound, (unpacked == unpackedFiles.end()), "File described in blockmap not contained in OPC container");
+                auto blocks = blockMapInternal->GetBlocks(blockMapName);
+                ThrowErrorIf(Error::BlockMapSemanticError, (blocks.size() != unpacked->second.hashes.size()),
+                    "Number of blocks of the file in the block map and the OPC container don't match");
+                for (std::size_t index = 0; index < blocks.size(); index++)
+                {
+                    const auto& hash = unpacked->second.hashes[index];
+                    ThrowErrorIfNot(Error::SignatureInvalid,
+                        (blocks[index].hash.size() == hash.size()) && (std::memcmp(blocks[index].hash.data(), hash.data(), hash.size()) == 0),
+                        "Signature hash doesn't match digest hash");
+                }
+                UINT64 blockMapFileSize = 0;
+                ThrowHrIfFailed(blockMapInternal->GetFile(blockMapName)->GetUncompressedSize(&blockMapFileSize));
+                ThrowErrorIf(Error::BlockMapSemanticError, (blockMapFileSize != unpacked->second.size),
+                    "Uncompressed size of the file in the block map and the OPC container don't match");
+            }
+
+            // Everything checks out, the payload files can be moved to their names.
+            for (const auto& file : stagedFiles)
+            {   to->RenameFile(file.first, file.second);
+            }
+            to->Remove(stagingDirectory);
+
+            for (const auto& fileName : self->GetFootprintFiles())
+            {
+                auto targetFile = to->OpenFile(DecodeFileName(fileName), MSIX::FileStream::Mode::WRITE);
+                ULARGE_INTEGER bytesCount = {0};
+                bytesCount.QuadPart = std::numeric_limits<std::uint64_t>::max();
+                ThrowHrIfFailed(self->GetFile(fileName)->CopyTo(targetFile.Get(), bytesCount, nullptr, nullptr));
+                ThrowHrIfFailed(targetFile->Commit(0));
+            }
+        }
+        catch (...)
+        {   // Best effort, the error that got here is the one reported.
+            try
+            {
+                for (const auto& file : stagedFiles) { to->Remove(file.first); }
+                to->Remove(stagingDirectory);
+            }
+            catch (...) {}
+            throw;
+        }
+    }
+
     // IStorageObject
     const char* AppxPackageObject::GetPathSeparator() { return "/"; }
 
@@ -92,6 +92,7 @@ MIDL_DEFINE_GUID(IID, IID_IAppxBlockMapInternal, 0x67fed21a,0x70ef,0x4175,0x8f,0
 MIDL_DEFINE_GUID(IID, IID_IAppxManifestObject,   0xeff6d561,0xa236,0x4058,0x9f,0x1d,0x8f,0x93,0x63,0x3f,0xba,0x4b);
 MIDL_DEFINE_GUID(IID, IID_IAppxManifestPackageIdInternal, 0x76b7d3e1,0x768a,0x45cb,0x96,0x26,0xba,0x64,0x52,0xbe,0xd2,0xde);
 MIDL_DEFINE_GUID(IID, IID_IStreamInternal,            0x44d2a7a8,0xa165,0x4a6e,0xa5,0x6f,0xc7,0xc2,0x4d,0xe7,0x50,0x5c);
+MIDL_DEFINE_GUID(IID, IID_IStreamBuffer,              0x3a0b3541,0x5b94,0x47a7,0x99,0x12,0x01,0xbd,0xd7,0x18,0xa5,0xa0);
 
 // Internal bundle interfaces
 #ifdef BUNDLE_SUPPORT
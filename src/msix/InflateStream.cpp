@@ -19,6 +19,18 @@ namespace MSIX {
     // See zlib's updatewindow comment.
     static const size_t BufferSize = 32*1024;
 
+    // Initial distance in uncompressed bytes between two checkpoints.
+    static const ULONGLONG CheckpointSpan = 1024*1024;
+
+    // Where to go once everything inflated so far has been consumed. Inflate stops when the window is full,
+    // at the end of a deflate block or when it runs out of input; only in the last case is more input needed.
+    static InflateStream::State GetNextState(InflateStream* self)
+    {
+        ThrowErrorIf(Error::InflateCorruptData, (self->m_compressionStatus == CompressionStatus::End), "unexpected end of data");
+        return ((self->m_compressionObject->GetAvailableDestinationSize() == 0) || (self->m_compressionObject->GetAvailableSourceSize() != 0)) ?
+            InflateStream::State::READY_TO_INFLATE : InflateStream::State::READY_TO_READ;
+    }
+
     struct InflateHandler
     {
         typedef std::pair<bool, InflateStream::State>(*lambda)(InflateStream* self, void* buffer, ULONG countBytes);
@@ -31,12 +43,16 @@ namespace MSIX {
         // State::UNINITIALIZED
         InflateHandler([](InflateStream* self, void*, ULONG)
         {
-            ThrowHrIfFailed(self->m_stream->Seek({0}, StreamBase::START, nullptr));
-            self->m_fileCurrentPosition = 0;
-            self->m_fileCurrentWindowPositionEnd = 0;
+            if (!self->RestoreCheckpoint())
+            {
+                ThrowHrIfFailed(self->m_stream->Seek({0}, StreamBase::START, nullptr));
+                self->m_compressedPosition = 0;
+                self->m_fileCurrentPosition = 0;
+                self->m_fileCurrentWindowPositionEnd = 0;
 
-            self->m_compressionStatus = self->m_compressionObject->Initialize(CompressionOperation::Inflate);
-            ThrowErrorIfNot(Error::InflateInitialize, (self->m_compressionStatus == CompressionStatus::Ok), "compression_stream_init failed");
+                self->m_compressionStatus = self->m_compressionObject->Initialize(CompressionOperation::Inflate);
+                ThrowErrorIfNot(Error::InflateInitialize, (self->m_compressionStatus == CompressionStatus::Ok), "compression_stream_init failed");
+            }
             return std::make_pair(true, InflateStream::State::READY_TO_READ);
         }), // State::UNINITIALIZED
 
@@ -45,9 +61,10 @@ namespace MSIX {
         {
             ThrowErrorIfNot(Error::InflateRead,(self->m_compressionObject->GetAvailableSourceSize() == 0), "uninflated bytes overwritten");
             ULONG available = 0;
-            self->m_compressedBuffer = std::make_unique<std::vector<std::uint8_t>>(BufferSize);
+            if (!self->m_compressedBuffer) { self->m_compressedBuffer = BufferPool::Get(BufferSize); }
             ThrowHrIfFailed(self->m_stream->Read(self->m_compressedBuffer->data(), static_cast<ULONG>(self->m_compressedBuffer->size()), &available));
             ThrowErrorIf(Error::FileRead, (available == 0), "Getting nothing back is unexpected here.");
+            self->m_compressedPosition += available;
             self->m_compressionObject->SetInput(self->m_compressedBuffer->data(), static_cast<size_t>(available));
             return std::make_pair(true, InflateStream::State::READY_TO_INFLATE);
         }), // State::READY_TO_READ
@@ -55,10 +72,11 @@ namespace MSIX {
         // State::READY_TO_INFLATE
         InflateHandler([](InflateStream* self, void*, ULONG)
         {
-            self->m_inflateWindow = std::make_unique<std::vector<std::uint8_t>>(BufferSize);
+            if (!self->m_inflateWindow) { self->m_inflateWindow = BufferPool::Get(BufferSize); }
             self->m_inflateWindowPosition = 0;
             self->m_compressionObject->SetOutput(self->m_inflateWindow->data(), self->m_inflateWindow->size());
-            self->m_compressionStatus = self->m_compressionObject->Inflate();
+            self->m_compressionStatus = self->m_collectCheckpoints ?
+                self->m_compressionObject->InflateToBlockBoundary() : self->m_compressionObject->Inflate();
             switch (self->m_compressionStatus)
             {
             case CompressionStatus::Error:
@@ -69,6 +87,7 @@ namespace MSIX {
             case CompressionStatus::End:
             default:
                 self->m_fileCurrentWindowPositionEnd += (BufferSize - self->m_compressionObject->GetAvailableDestinationSize());
+                if (self->m_collectCheckpoints) { self->CreateCheckpoint(); }
                 return std::make_pair(true, InflateStream::State::READY_TO_COPY);
             }
         }), // State::READY_TO_INFLATE
@@ -87,20 +106,21 @@ namespace MSIX {
             if (self->m_fileCurrentWindowPositionEnd < self->m_seekPosition)
             {
                 self->m_fileCurrentPosition = self->m_fileCurrentWindowPositionEnd;
-                return std::make_pair(true, (self->m_compressionObject->GetAvailableDestinationSize() == 0) ? InflateStream::State::READY_TO_INFLATE : InflateStream::State::READY_TO_READ);
+                return std::make_pair(true, GetNextState(self));
             }
 
             // now that we're within the window between current file position and seek position
             // calculate the number of bytes to skip ahead within this window
             ULONG bytesToSkipInWindow = (ULONG)(self->m_seekPosition - self->m_fileCurrentPosition);
             self->m_inflateWindowPosition += bytesToSkipInWindow;
+            self->m_fileCurrentPosition   += bytesToSkipInWindow;
 
             // Calculate the difference between the beginning of the window and the seek position.
             // if there's nothing left in the window to copy, then we need to fetch another window.
             ULONG bytesRemainingInWindow = static_cast<ULONG>((BufferSize - self->m_compressionObject->GetAvailableDestinationSize()) - self->m_inflateWindowPosition);
             if (bytesRemainingInWindow == 0)
             {
-                return std::make_pair(true, (self->m_compressionObject->GetAvailableDestinationSize() == 0) ? InflateStream::State::READY_TO_INFLATE : InflateStream::State::READY_TO_READ);
+                return std::make_pair(true, GetNextState(self));
             }
 
             ULONG bytesToCopy = std::min(countBytes, bytesRemainingInWindow);
@@ -132,10 +152,12 @@ namespace MSIX {
     };
 
     InflateStream::InflateStream(
-        const ComPtr<IStream>& stream, std::uint64_t uncompressedSize
+        const ComPtr<IStream>& stream, std::uint64_t uncompressedSize, std::size_t checkpointMemoryLimit
     ) : m_stream(stream),
         m_state(State::UNINITIALIZED),
-        m_uncompressedSize(uncompressedSize)
+        m_uncompressedSize(uncompressedSize),
+        m_checkpointSpan(CheckpointSpan),
+        m_checkpointMemoryLimit(checkpointMemoryLimit)
     {
         m_compressionObject = CreateCompressionObject();
     }
@@ -165,6 +187,20 @@ namespace MSIX {
         return static_cast<HRESULT>(Error::OK);
     } CATCH_RETURN();
 
+    HRESULT InflateStream::Clone(IStream** stream) noexcept try
+    {
+        ThrowErrorIf(Error::InvalidParameter, (stream == nullptr || *stream != nullptr), "bad pointer");
+        ComPtr<IStream> compressedStream;
+        ThrowHrIfFailed(m_stream->Clone(&compressedStream));
+        LARGE_INTEGER position = { 0 };
+        ThrowHrIfFailed(compressedStream->Seek(position, Reference::START, nullptr));
+        auto clone = ComPtr<IStream>::Make<InflateStream>(compressedStream, m_uncompressedSize, m_checkpointMemoryLimit);
+        position.QuadPart = static_cast<LONGLONG>(m_seekPosition);
+        ThrowHrIfFailed(clone->Seek(position, Reference::START, nullptr));
+        *stream = clone.Detach();
+        return static_cast<HRESULT>(Error::OK);
+    } CATCH_RETURN();
+
     HRESULT InflateStream::Seek(LARGE_INTEGER move, DWORD origin, ULARGE_INTEGER *newPosition) noexcept try
     {
         LARGE_INTEGER seekPosition = { 0 };
@@ -189,14 +225,25 @@ namespace MSIX {
             m_seekPosition = seekPosition.QuadPart;
             // If the caller is trying to seek back to an earlier
             // point in the inflated stream, we will need to reset
-            // zlib and start inflating from the beginning of the
-            // stream; otherwise, seeking forward is fine: We will
-            // catch up to the seek pointer during the ::Read operation.
+            // zlib and start inflating again from the closest
+            // checkpoint, or from the beginning of the stream;
+            // otherwise, seeking forward is fine: We will catch up
+            // to the seek pointer during the ::Read operation.
             if (m_seekPosition < m_fileCurrentPosition)
             {
+                m_collectCheckpoints = m_collectCheckpoints || ((m_seekPosition != 0) && (m_checkpointMemoryLimit != 0));
                 m_fileCurrentPosition = 0;
                 Cleanup();
             }
+            else
+            {   // Unless there's a checkpoint closer to the seek position than what has been inflated already.
+                auto checkpoint = FindCheckpoint(m_seekPosition);
+                if ((checkpoint != nullptr) && (checkpoint->uncompressedOffset > m_fileCurrentWindowPositionEnd))
+                {
+                    m_fileCurrentPosition = 0;
+                    Cleanup();
+                }
+            }
         }
         if (newPosition) { newPosition->QuadPart = m_seekPosition; }
         return static_cast<HRESULT>(Error::OK);
@@ -209,6 +256,70 @@ namespace MSIX {
             m_compressionObject->Cleanup();
             m_state = State::UNINITIALIZED;
         }
+        // Give the buffers back for the next stream
+        m_compressedBuffer.reset();
+        m_inflateWindow.reset();
+    }
+
+    void InflateStream::CreateCheckpoint()
+    {
+        // Checkpoints are only created going forward, past the last one
+        ULONGLONG last = m_checkpoints.empty() ? 0 : m_checkpoints.back().uncompressedOffset;
+        if ((m_fileCurrentWindowPositionEnd >= m_uncompressedSize) || (m_fileCurrentWindowPositionEnd < last + m_checkpointSpan))
+        {
+            return;
+        }
+
+        Checkpoint checkpoint;
+        if (!m_compressionObject->CreateCheckpoint(checkpoint.state))
+        {   // Not at the end of a deflate block, try again on the next one.
+            return;
+        }
+        checkpoint.uncompressedOffset = m_fileCurrentWindowPositionEnd;
+        checkpoint.compressedOffset = m_compressedPosition - m_compressionObject->GetAvailableSourceSize();
+        m_checkpointMemory += checkpoint.state.size();
+        m_checkpoints.push_back(std::move(checkpoint));
+
+        while (m_checkpointMemory > m_checkpointMemoryLimit)
+        {
+            std::size_t kept = 0;
+            m_checkpointMemory = 0;
+            for (std::size_t i = 1; i < m_checkpoints.size(); i += 2)
+            {
+                m_checkpointMemory += m_checkpoints[i].state.size();
+                m_checkpoints[kept++] = std::move(m_checkpoints[i]);
+            }
+            m_checkpoints.resize(kept);
+            m_checkpointSpan *= 2;
+        }
+    }
+
+    const InflateStream::Checkpoint* InflateStream::FindCheckpoint(ULONGLONG position)
+    {
+        // Last checkpoint at or before position
+        auto checkpoint = std::upper_bound(m_checkpoints.begin(), m_checkpoints.end(), position,
+            [](ULONGLONG position, const Checkpoint& c) { return position < c.uncompressedOffset; });
+        return (checkpoint == m_checkpoints.begin()) ? nullptr : &*(checkpoint - 1);
+    }
+
+    bool InflateStream::RestoreCheckpoint()
+    {
+        auto checkpoint = FindCheckpoint(m_seekPosition);
+        if (checkpoint == nullptr)
+        {
+            return false;
+        }
+
+        LARGE_INTEGER offset = { 0 };
+        offset.QuadPart = static_cast<LONGLONG>(checkpoint->compressedOffset);
+        ThrowHrIfFailed(m_stream->Seek(offset, StreamBase::START, nullptr));
+        m_compressedPosition = checkpoint->compressedOffset;
+        m_fileCurrentPosition = checkpoint->uncompressedOffset;
+        m_fileCurrentWindowPositionEnd = checkpoint->uncompressedOffset;
+
+        m_compressionStatus = m_compressionObject->RestoreCheckpoint(checkpoint->state);
+        ThrowErrorIfNot(Error::InflateInitialize, (m_compressionStatus == CompressionStatus::Ok), "failed to restore inflate checkpoint");
+        return true;
     }
 } /* msix */
 
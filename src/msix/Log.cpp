@@ -4,12 +4,28 @@
 // 
 #include "Log.hpp"
 #include <sstream>
+#include <mutex>
 
 namespace MSIX { namespace Global { namespace Log {
 static std::stringstream g_content;
+static std::mutex g_contentLock; // errors can be logged from the workers of a parallel unpack
 
-void Append(const std::string& comment) { ((!comment.empty()) ? g_content << '\n' : g_content) << comment; }
-std::string Text() { return g_content.str(); }
-void Clear() { g_content.str(""), g_content.clear(); }
+void Append(const std::string& comment)
+{
+    std::lock_guard<std::mutex> lock(g_contentLock);
+    ((!comment.empty()) ? g_content << '\n' : g_content) << comment;
+}
+
+std::string Text()
+{
+    std::lock_guard<std::mutex> lock(g_contentLock);
+    return g_content.str();
+}
+
+void Clear()
+{
+    std::lock_guard<std::mutex> lock(g_contentLock);
+    g_content.str(""), g_content.clear();
+}
 
 } /* log */ } /* Global */ } /* msix */
\ No newline at end of file
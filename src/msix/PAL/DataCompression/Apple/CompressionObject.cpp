@@ -35,6 +35,40 @@ namespace MSIX {
             return GetStatus(compression_stream_process(&m_compressionStream, 0));
         }
 
+        // libcompression doesn't expose block boundaries or its window, so there are no checkpoints.
+        CompressionStatus InflateToBlockBoundary() noexcept
+        {
+            return Inflate();
+        }
+
+        bool CreateCheckpoint(std::vector<uint8_t>& checkpoint) noexcept
+        {
+            return false;
+        }
+
+        CompressionStatus RestoreCheckpoint(const std::vector<uint8_t>& checkpoint) noexcept
+        {
+            return CompressionStatus::Error;
+        }
+
+        CompressionStatus InflateBuffer(const uint8_t* source, size_t sourceSize, uint8_t* destination, size_t destinationSize) noexcept
+        {
+            // compression_decode_buffer would also accept truncated or oversized data, so stream instead.
+            compression_stream stream = {0};
+            if (compression_stream_init(&stream, COMPRESSION_STREAM_DECODE, COMPRESSION_ZLIB) != COMPRESSION_STATUS_OK)
+            {
+                return CompressionStatus::Error;
+            }
+            stream.src_ptr = source;
+            stream.src_size = sourceSize;
+            stream.dst_ptr = destination;
+            stream.dst_size = destinationSize;
+            auto status = GetStatus(compression_stream_process(&stream, 0));
+            bool inflated = ((status == CompressionStatus::Ok) || (status == CompressionStatus::End)) && (stream.src_size == 0) && (stream.dst_size == 0);
+            compression_stream_destroy(&stream);
+            return inflated ? CompressionStatus::Ok : CompressionStatus::Error;
+        }
+
         CompressionStatus Cleanup() noexcept
         {
             return GetStatus(compression_stream_destroy(&m_compressionStream));
@@ -4,25 +4,70 @@
 //
 #include "ICompressionObject.hpp"
 #include "Exceptions.hpp"
+#include "BufferPool.hpp"
+
+#include <cstring>
 #ifdef WIN32
 #include "zlib.h"
 #else
 #include <zlib.h>
 #endif
+#ifdef USE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
 
 using namespace std;
 
 namespace MSIX {
 
+    // zlib allocates its state and window every time a stream is initialized. Those come from the buffer
+    // pool instead, so inflating one file (or block) after another doesn't go back to the heap. Each
+    // allocation is prefixed by the pooled vector that owns it.
+    static const size_t PooledAllocationHeader = 16;
+
+    // zlib is C, nothing may be thrown through it. A failed allocation returns Z_NULL, which inflate
+    // reports as Z_MEM_ERROR.
+    static voidpf PooledAlloc(voidpf, uInt items, uInt size) noexcept try
+    {
+        auto buffer = BufferPool::Get(PooledAllocationHeader + static_cast<size_t>(items) * size).release();
+        memcpy(buffer->data(), &buffer, sizeof(buffer));
+        return buffer->data() + PooledAllocationHeader;
+    }
+    catch (...)
+    {
+        return Z_NULL;
+    }
+
+    static void PooledFree(voidpf, voidpf address) noexcept try
+    {
+        std::vector<uint8_t>* buffer = nullptr;
+        memcpy(&buffer, static_cast<uint8_t*>(address) - PooledAllocationHeader, sizeof(buffer));
+        BufferPool::Buffer release(buffer);
+    }
+    catch (...)
+    {
+    }
+
     class CompressionObject final : public ICompressionObject
     {
     public:
         CompressionObject() = default;
 
+        ~CompressionObject()
+        {
+            #ifdef USE_LIBDEFLATE
+            if (m_decompressor) { libdeflate_free_decompressor(m_decompressor); }
+            #else
+            if (m_bufferStreamInitialized) { inflateEnd(&m_bufferStream); }
+            #endif
+        }
+
         // ICompressionObject interface
         CompressionStatus Initialize(CompressionOperation operation) noexcept
         {
             m_zstrm = { 0 };
+            m_zstrm.zalloc = PooledAlloc;
+            m_zstrm.zfree = PooledFree;
 
             switch (operation)
             {
@@ -36,7 +81,49 @@ namespace MSIX {
 
         CompressionStatus Inflate() noexcept
         {
-            return GetStatus(inflate(&m_zstrm, Z_NO_FLUSH));
+            return InflateWithFlush(Z_NO_FLUSH);
+        }
+
+        CompressionStatus InflateToBlockBoundary() noexcept
+        {
+            return InflateWithFlush(Z_BLOCK);
+        }
+
+        // A checkpoint is the number of bits of the last input byte that zlib has not used yet, that
+        // byte, and the last 32KB of output that the next blocks may refer back to (see zran.c).
+        bool CreateCheckpoint(std::vector<uint8_t>& checkpoint) noexcept
+        {
+            // Bit 7 is set when zlib stopped at the beginning of a block, bit 6 if that was the last one.
+            if (((m_zstrm.data_type & 128) == 0) || ((m_zstrm.data_type & 64) != 0))
+            {
+                return false;
+            }
+            uInt windowSize = 0;
+            if (inflateGetDictionary(&m_zstrm, nullptr, &windowSize) != Z_OK)
+            {
+                return false;
+            }
+            checkpoint.resize(CheckpointHeaderSize + windowSize);
+            checkpoint[0] = static_cast<uint8_t>(m_zstrm.data_type & 7);
+            checkpoint[1] = m_lastInputByte;
+            return (inflateGetDictionary(&m_zstrm, checkpoint.data() + CheckpointHeaderSize, &windowSize) == Z_OK);
+        }
+
+        CompressionStatus RestoreCheckpoint(const std::vector<uint8_t>& checkpoint) noexcept
+        {
+            if (checkpoint.size() < CheckpointHeaderSize) { return CompressionStatus::Error; }
+            auto status = Initialize(CompressionOperation::Inflate);
+            if (status != CompressionStatus::Ok) { return status; }
+            int bits = checkpoint[0];
+            if (bits != 0)
+            {
+                status = GetStatus(inflatePrime(&m_zstrm, bits, checkpoint[1] >> (8 - bits)));
+                if (status != CompressionStatus::Ok) { return status; }
+            }
+            m_lastInputByte = checkpoint[1];
+            if (checkpoint.size() == CheckpointHeaderSize) { return status; }
+            return GetStatus(inflateSetDictionary(&m_zstrm, checkpoint.data() + CheckpointHeaderSize,
+                static_cast<uInt>(checkpoint.size() - CheckpointHeaderSize)));
         }
 
         CompressionStatus Cleanup() noexcept
@@ -66,15 +153,88 @@ namespace MSIX {
             m_zstrm.avail_out = static_cast<uint32_t>(size);
         }
 
+        #ifdef USE_LIBDEFLATE
+        // libdeflate decodes a whole buffer considerably faster than zlib, but only stops at the last block of
+        // a deflate stream. A block that ends on a flush point is terminated with an empty final block first.
+        CompressionStatus InflateBuffer(const uint8_t* source, size_t sourceSize, uint8_t* destination, size_t destinationSize) noexcept
+        {
+            static const uint8_t EmptyFinalBlock[] = { 0x03, 0x00 };
+            if (!m_decompressor)
+            {
+                m_decompressor = libdeflate_alloc_decompressor();
+                if (!m_decompressor) { return CompressionStatus::Error; }
+            }
+            auto input = BufferPool::Get(sourceSize + sizeof(EmptyFinalBlock));
+            memcpy(input->data(), source, sourceSize);
+            memcpy(input->data() + sourceSize, EmptyFinalBlock, sizeof(EmptyFinalBlock));
+            size_t consumed = 0;
+            size_t produced = 0;
+            auto result = libdeflate_deflate_decompress_ex(m_decompressor, input->data(), input->size(), destination, destinationSize, &consumed, &produced);
+            return ((result == LIBDEFLATE_SUCCESS) && (consumed >= sourceSize) && (produced == destinationSize)) ?
+                CompressionStatus::Ok : CompressionStatus::Error;
+        }
+        #else
+        // The inflate state and window are kept between calls and only reset.
+        CompressionStatus InflateBuffer(const uint8_t* source, size_t sourceSize, uint8_t* destination, size_t destinationSize) noexcept
+        {
+            if (!m_bufferStreamInitialized)
+            {
+                m_bufferStream = { 0 };
+                m_bufferStream.zalloc = PooledAlloc;
+                m_bufferStream.zfree = PooledFree;
+                if (inflateInit2(&m_bufferStream, -MAX_WBITS) != Z_OK) { return CompressionStatus::Error; }
+                m_bufferStreamInitialized = true;
+            }
+            else if (inflateReset(&m_bufferStream) != Z_OK)
+            {
+                return CompressionStatus::Error;
+            }
+            m_bufferStream.next_in = const_cast<uint8_t*>(source);
+            m_bufferStream.avail_in = static_cast<uInt>(sourceSize);
+            m_bufferStream.next_out = destination;
+            m_bufferStream.avail_out = static_cast<uInt>(destinationSize);
+            // A block usually ends on a flush point rather than with the final deflate block, so Z_FINISH can't
+            // end the stream and inflate returns Z_BUF_ERROR once the input is used up. Whether the block was
+            // whole is told by the sizes.
+            auto result = inflate(&m_bufferStream, Z_FINISH);
+            return (((result == Z_OK) || (result == Z_STREAM_END) || (result == Z_BUF_ERROR)) && (m_bufferStream.avail_in == 0) && (m_bufferStream.avail_out == 0)) ?
+                CompressionStatus::Ok : CompressionStatus::Error;
+        }
+        #endif
+
     private:
+        static const size_t CheckpointHeaderSize = 2;
+
         z_stream        m_zstrm;
+        // The last byte inflate consumed. It may have been consumed on an earlier call than the one
+        // that reaches a block boundary, so it has to be remembered across calls for CreateCheckpoint.
+        uint8_t         m_lastInputByte = 0;
+        // Used by InflateBuffer, separate from the streaming state.
+        #ifdef USE_LIBDEFLATE
+        libdeflate_decompressor* m_decompressor = nullptr;
+        #else
+        z_stream        m_bufferStream;
+        bool            m_bufferStreamInitialized = false;
+        #endif
+
+        CompressionStatus InflateWithFlush(int flush) noexcept
+        {
+            auto availableBefore = m_zstrm.avail_in;
+            auto status = GetStatus(inflate(&m_zstrm, flush));
+            if (m_zstrm.avail_in != availableBefore)
+            {
+                m_lastInputByte = m_zstrm.next_in[-1];
+            }
+            return status;
+        }
 
         CompressionStatus GetStatus(int status)
         {
             switch (status)
             {
                 case Z_BUF_ERROR:
-                    // Since we do not use Z_FINISH, Z_BUF_ERROR just means there is nothing to do.
+                    // Only InflateBuffer uses Z_FINISH and it checks the result itself. Without Z_FINISH,
+                    // Z_BUF_ERROR just means there is nothing to do.
                     //__fallthrough;
                 case Z_OK:
                     return CompressionStatus::Ok;
@@ -5,10 +5,16 @@
 #include "Exceptions.hpp"
 #include "StreamBase.hpp"
 #include "DirectoryObject.hpp"
+#include "BufferPool.hpp"
+#include <algorithm>
+#include <cstring>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <fts.h>
+#include <stdio.h>
 
 namespace MSIX {
 
@@ -26,6 +32,8 @@ namespace MSIX {
     
     const char* DirectoryObject::GetPathSeparator() { return "/"; }
 
+    static const std::size_t MaxOpenDirectories = 256;
+
     #define DEFAULT_MODE S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH
     void mkdirp(std::string& path, mode_t mode = DEFAULT_MODE)
     {
@@ -43,13 +51,259 @@ namespace MSIX {
         }
     }
 
+    // Write only stream over a file created by DirectoryObject::OpenFile in WRITE mode. Writes are gathered in a large
+    // buffer so extracting a file takes few system calls. If unbuffered writes were asked for and SetSize
+    // says the file is large, the file is switched to O_DIRECT and the buffer written out in aligned
+    // pieces; the unaligned tail is written once O_DIRECT is turned off again.
+    class OutputFileStream final : public StreamBase
+    {
+    public:
+        OutputFileStream(int fd, std::string name, bool unbufferedWrites) :
+            m_fd(fd), m_name(std::move(name)), m_unbufferedWrites(unbufferedWrites)
+        {}
+
+        virtual ~OutputFileStream() override
+        {
+            // Commit reports write errors. What's still buffered if it wasn't called can only be logged.
+            try { Flush(true); }
+            catch (...) { Global::Log::Append("Failed to write the end of " + m_name); }
+            close(m_fd);
+        }
+
+        // IStream
+        HRESULT STDMETHODCALLTYPE Write(const void* buffer, ULONG countBytes, ULONG* bytesWritten) noexcept override try
+        {
+            if (bytesWritten) { *bytesWritten = 0; }
+            auto data = static_cast<const std::uint8_t*>(buffer);
+            if (!m_direct && (m_buffered == 0) && (countBytes >= BufferSize))
+            {   // Nothing to gain from copying writes this big
+                WriteAll(data, countBytes);
+            }
+            else
+            {
+                std::size_t remaining = countBytes;
+                while (remaining > 0)
+                {
+                    if (m_buffer == nullptr)
+                    {   // Always aligned, so the file can go to O_DIRECT whenever SetSize asks for it.
+                        m_storage = BufferPool::Get(BufferSize + DirectAlignment);
+                        auto address = reinterpret_cast<std::uintptr_t>(m_storage->data());
+                        m_buffer = m_storage->data() + ((DirectAlignment - (address % DirectAlignment)) % DirectAlignment);
+                    }
+                    std::size_t count = std::min(remaining, BufferSize - m_buffered);
+                    std::memcpy(m_buffer + m_buffered, data, count);
+                    m_buffered += count;
+                    data += count;
+                    remaining -= count;
+                    if (m_buffered == BufferSize) { Flush(false); }
+                }
+            }
+            m_position += countBytes;
+            if (bytesWritten) { *bytesWritten = countBytes; }
+            return static_cast<HRESULT>(Error::OK);
+        } CATCH_RETURN();
+
+        HRESULT STDMETHODCALLTYPE Seek(LARGE_INTEGER move, DWORD origin, ULARGE_INTEGER* newPosition) noexcept override try
+        {
+            if ((origin == Reference::CURRENT) && (move.QuadPart == 0))
+            {   // Only asking where the stream is, which doesn't need what is buffered to be written.
+                if (newPosition) { newPosition->QuadPart = m_position; }
+                return static_cast<HRESULT>(Error::OK);
+            }
+            Flush(true);
+            off_t position = lseek(m_fd, static_cast<off_t>(move.QuadPart), static_cast<int>(origin));
+            ThrowErrorIf(Error::FileSeek, (position == -1), m_name.c_str());
+            m_position = static_cast<std::uint64_t>(position);
+            if (newPosition) { newPosition->QuadPart = m_position; }
+            return static_cast<HRESULT>(Error::OK);
+        } CATCH_RETURN();
+
+        // Reserves the space of the whole file up front. This is only a hint, the file still grows as it is written.
+        HRESULT STDMETHODCALLTYPE SetSize(ULARGE_INTEGER newSize) noexcept override try
+        {
+            #ifdef LINUX
+            if (newSize.QuadPart == 0) { return static_cast<HRESULT>(Error::OK); }
+            if (fallocate(m_fd, FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>(newSize.QuadPart)) != 0)
+            {   return static_cast<HRESULT>(Error::NotSupported);
+            }
+            // Not every file system takes O_DIRECT, in which case the file is simply written buffered.
+            if (m_unbufferedWrites && !m_direct && (m_position == 0) && (m_buffered == 0) && (newSize.QuadPart >= DirectThreshold))
+            {   m_direct = SetDirect(true);
+            }
+            return static_cast<HRESULT>(Error::OK);
+            #else
+            return static_cast<HRESULT>(Error::NotSupported);
+            #endif
+        } CATCH_RETURN();
+
+        HRESULT STDMETHODCALLTYPE Commit(DWORD) noexcept override try
+        {
+            Flush(true);
+            return static_cast<HRESULT>(Error::OK);
+        } CATCH_RETURN();
+
+        // IStreamInternal
+        std::string GetName() override { return m_name; }
+
+        // IStreamBuffer
+        bool GetFileDescriptor(std::uint64_t offset, int* descriptor, std::uint64_t* descriptorOffset) override
+        {
+            // Whatever the kernel copies into the file has to land past what is buffered.
+            if (m_direct) { return false; }
+            Flush(true);
+            *descriptor = m_fd;
+            *descriptorOffset = offset;
+            return true;
+        }
+
+    protected:
+        static const std::size_t BufferSize = 512 * 1024;
+        static const std::size_t DirectAlignment = 4096;
+        static const std::uint64_t DirectThreshold = 64 * 1024 * 1024;
+
+        bool SetDirect(bool direct)
+        {
+            #ifdef LINUX
+            int flags = fcntl(m_fd, F_GETFL);
+            if (flags == -1) { return false; }
+            flags = direct ? (flags | O_DIRECT) : (flags & ~O_DIRECT);
+            return (fcntl(m_fd, F_SETFL, flags) == 0);
+            #else
+            return false;
+            #endif
+        }
+
+        void WriteAll(const std::uint8_t* data, std::size_t size)
+        {
+            while (size > 0)
+            {
+                ssize_t written = write(m_fd, data, size);
+                if (written == -1 && errno == EINTR) { continue; }
+                ThrowErrorIf(Error::FileWrite, (written <= 0), m_name.c_str());
+                data += written;
+                size -= static_cast<std::size_t>(written);
+            }
+        }
+
+        // Writes out what is buffered. In O_DIRECT only whole aligned pieces can be written, so unless
+        // all is set the unaligned rest stays in the buffer. Writing all of it leaves O_DIRECT.
+        void Flush(bool all)
+        {
+            if (m_buffered == 0) { return; }
+            std::size_t count = m_buffered;
+            if (m_direct)
+            {
+                count = m_buffered - (m_buffered % DirectAlignment);
+                if (all && (count != m_buffered))
+                {
+                    WriteAll(m_buffer, count);
+                    m_direct = false;
+                    ThrowErrorIfNot(Error::FileWrite, SetDirect(false), m_name.c_str());
+                    WriteAll(m_buffer + count, m_buffered - count);
+                    m_buffered = 0;
+                    return;
+                }
+            }
+            WriteAll(m_buffer, count);
+            std::memmove(m_buffer, m_buffer + count, m_buffered - count);
+            m_buffered -= count;
+        }
+
+        int                 m_fd = -1;
+        std::string         m_name;
+        bool                m_unbufferedWrites = false;
+        bool                m_direct = false;
+        BufferPool::Buffer  m_storage;
+        std::uint8_t*       m_buffer = nullptr;
+        std::size_t         m_buffered = 0;
+        std::uint64_t       m_position = 0;
+    };
+
+    DirectoryObject::~DirectoryObject()
+    {
+        for (const auto& directory : m_directories)
+        {
+            if (directory.second != -1) { close(directory.second); }
+        }
+    }
+
+    // Creates the directory path under m_root, and all its parents, unless that was already done.
+    // Returns the open directory or -1 if too many are open already. m_directoriesLock must be held.
+    int DirectoryObject::GetDirectory(const std::string& path)
+    {
+        auto found = m_directories.find(path);
+        if (found != m_directories.end()) { return found->second; }
+
+        if (path.empty())
+        {
+            std::string root = m_root;
+            mkdirp(root);
+            int fd = open(m_root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            ThrowErrorIf(Error::FileOpen, (fd == -1), m_root.c_str());
+            m_directories[path] = fd;
+            m_openDirectories++;
+            return fd;
+        }
+
+        auto lastSlash = path.find_last_of('/');
+        int parent = GetDirectory((lastSlash == std::string::npos) ? std::string() : path.substr(0, lastSlash));
+        // Once directories aren't kept open anymore they are made relative to the root.
+        std::string name = (parent != -1) ? path.substr((lastSlash == std::string::npos) ? 0 : lastSlash + 1) : path;
+        if (parent == -1) { parent = m_directories[std::string()]; }
+
+        ThrowErrorIfNot(Error::FileCreateDirectory, (mkdirat(parent, name.c_str(), DEFAULT_MODE) != -1 || errno == EEXIST), path.c_str());
+        int fd = -1;
+        if (m_openDirectories < MaxOpenDirectories)
+        {
+            fd = openat(parent, name.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            ThrowErrorIf(Error::FileCreateDirectory, (fd == -1), path.c_str());
+            m_openDirectories++;
+        }
+        m_directories[path] = fd;
+        return fd;
+    }
+
     ComPtr<IStream> DirectoryObject::OpenFile(const std::string& fileName, MSIX::FileStream::Mode mode)
     {
-        std::string name = m_root + "/" + fileName;
-        auto lastSlash = name.find_last_of("/");
-        std::string path = name.substr(0, lastSlash);
-        mkdirp(path);
-        auto result = ComPtr<IStream>::Make<FileStream>(std::move(name), mode);
+        // OutputFileStream can't be read, everything but WRITE goes through FileStream.
+        if (mode != FileStream::Mode::WRITE)
+        {
+            std::string name = m_root + "/" + fileName;
+            auto lastSlash = name.find_last_of("/");
+            std::string path = name.substr(0, lastSlash);
+            mkdirp(path);
+            auto result = ComPtr<IStream>::Make<FileStream>(std::move(name), mode);
+            return result;
+        }
+
+        // Files are created relative to their directory, which is only created the first time a file
+        // in it is written.
+        auto lastSlash = fileName.find_last_of('/');
+        std::string path = (lastSlash == std::string::npos) ? std::string() : fileName.substr(0, lastSlash);
+        int directory = -1;
+        {
+            std::lock_guard<std::mutex> lock(m_directoriesLock);
+            directory = GetDirectory(path);
+            if (directory == -1) { directory = m_directories[std::string()]; }
+            else { path.clear(); }
+        }
+        std::string name = path.empty() ? fileName.substr((lastSlash == std::string::npos) ? 0 : lastSlash + 1) : fileName;
+        int fd = openat(directory, name.c_str(), O_CREAT | O_TRUNC | O_CLOEXEC | O_WRONLY, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+        ThrowErrorIf(Error::FileOpen, (fd == -1), (m_root + "/" + fileName).c_str());
+        auto result = ComPtr<IStream>::Make<OutputFileStream>(fd, m_root + "/" + fileName, m_unbufferedWrites);
         return result;
     }
+
+    void DirectoryObject::RenameFile(const std::string& fileName, const std::string& newName)
+    {
+        std::string name = m_root + "/" + newName;
+        std::string path = name.substr(0, name.find_last_of("/"));
+        mkdirp(path);
+        ThrowErrorIf(Error::FileWrite, (rename((m_root + "/" + fileName).c_str(), name.c_str()) != 0), name.c_str());
+    }
+
+    bool DirectoryObject::Remove(const std::string& fileName)
+    {
+        return (remove((m_root + "/" + fileName).c_str()) == 0);
+    }
 }
@@ -14,6 +14,7 @@
 #include <sstream>
 #include <locale>
 #include <codecvt>
+#include <algorithm>
 #include "MSIXWindows.hpp"
 #include "UnicodeConversion.hpp"
 
@@ -98,6 +99,8 @@ namespace MSIX {
             "FindNextFile");
     }
 
+    DirectoryObject::~DirectoryObject() {}
+
     const char* DirectoryObject::GetPathSeparator() { return "\\"; }
 
     std::vector<std::string> DirectoryObject::GetFileNames(FileNameOptions)
@@ -166,6 +169,35 @@ namespace MSIX {
         auto result = ComPtr<IStream>::Make<FileStream>(std::move(path), mode);
         return result;
     }
+
+    static std::wstring GetFullPath(const std::string& root, const std::string& fileName)
+    {
+        std::string path = root + "/" + fileName;
+        std::replace(path.begin(), path.end(), '/', '\\');
+        return utf8_to_wstring(path);
+    }
+
+    void DirectoryObject::RenameFile(const std::string& fileName, const std::string& newName)
+    {
+        // Only the root is known to exist, the directories of the new name are created one by one.
+        for (auto slash = newName.find('/'); slash != std::string::npos; slash = newName.find('/', slash + 1))
+        {
+            if (!CreateDirectory(GetFullPath(m_root, newName.substr(0, slash)).c_str(), nullptr))
+            {
+                auto lastError = GetLastError();
+                ThrowWin32ErrorIfNot(lastError, (lastError == ERROR_ALREADY_EXISTS), "CreateDirectory");
+            }
+        }
+        ThrowWin32ErrorIfNot(GetLastError(),
+            MoveFileEx(GetFullPath(m_root, fileName).c_str(), GetFullPath(m_root, newName).c_str(), MOVEFILE_REPLACE_EXISTING),
+            "MoveFileEx");
+    }
+
+    bool DirectoryObject::Remove(const std::string& fileName)
+    {
+        auto path = GetFullPath(m_root, fileName);
+        return DeleteFile(path.c_str()) || RemoveDirectory(path.c_str());
+    }
 }
 
 // Don't pollute other compilation units with any of our #defs...
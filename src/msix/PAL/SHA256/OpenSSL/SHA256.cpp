@@ -8,6 +8,29 @@
 #include "openssl/sha.h"
 
 namespace MSIX {
+    struct SHA256::HashContext
+    {
+        SHA256_CTX context;
+    };
+
+    SHA256::SHA256() : m_context(std::make_unique<HashContext>())
+    {
+        ThrowErrorIfNot(Error::Unexpected, (SHA256_Init(&m_context->context) == 1), "failed computing SHA256 hash");
+    }
+
+    SHA256::~SHA256() {}
+
+    void SHA256::Update(const std::uint8_t* buffer, std::uint32_t cbBuffer)
+    {
+        ThrowErrorIfNot(Error::Unexpected, (SHA256_Update(&m_context->context, buffer, cbBuffer) == 1), "failed computing SHA256 hash");
+    }
+
+    void SHA256::FinalizeAndGetHashValue(std::vector<std::uint8_t>& hash)
+    {
+        hash.resize(SHA256_DIGEST_LENGTH);
+        ThrowErrorIfNot(Error::Unexpected, (SHA256_Final(hash.data(), &m_context->context) == 1), "failed computing SHA256 hash");
+    }
+
     bool SHA256::ComputeHash(std::uint8_t *buffer, std::uint32_t cbBuffer, std::vector<uint8_t>& hash)
     {
         hash.resize(SHA256_DIGEST_LENGTH);
@@ -44,40 +44,42 @@ namespace MSIX {
         }                                                                                  \
     }
 
-    bool SHA256::ComputeHash(std::uint8_t* buffer, std::uint32_t cbBuffer, std::vector<uint8_t>& hash)
+    struct SHA256::HashContext
+    {
+        unique_alg_handle  algHandle;
+        unique_hash_handle hashHandle;
+        DWORD              hashLength = 0;
+    };
+
+    SHA256::SHA256() : m_context(std::make_unique<HashContext>())
     {
         BCRYPT_HASH_HANDLE hashHandleT;
         BCRYPT_ALG_HANDLE algHandleT;
-        DWORD hashLength = 0;
         DWORD resultLength = 0;
 
         // Open an algorithm handle
-        // This code passes BCRYPT_HASH_REUSABLE_FLAG with BCryptAlgorithmProvider(...) to load a provider which supports reusable hash
         ThrowStatusIfFailed(BCryptOpenAlgorithmProvider(
             &algHandleT,                // Alg Handle pointer
             BCRYPT_SHA256_ALGORITHM,    // Cryptographic Algorithm name (null terminated unicode string)
             nullptr,                    // Provider name; if null, the default provider is loaded
-            0),                         // Flags; Loads a provider which supports reusable hash
+            0),                         // Flags
         "failed computing SHA256 hash");
+        m_context->algHandle.reset(algHandleT);
 
         // Obtain the length of the hash
-        unique_alg_handle algHandle(algHandleT);
         ThrowStatusIfFailed(BCryptGetProperty(
-            algHandle.get(),            // Handle to a CNG object
+            m_context->algHandle.get(), // Handle to a CNG object
             BCRYPT_HASH_LENGTH,         // Property name (null terminated unicode string)
-            (PBYTE)&hashLength,         // Address of the output buffer which receives the property value
-            sizeof(hashLength),         // Size of the buffer in bytes
+            (PBYTE)&m_context->hashLength, // Address of the output buffer which receives the property value
+            sizeof(m_context->hashLength), // Size of the buffer in bytes
             &resultLength,              // Number of bytes that were copied into the buffer
             0),                         // Flags
         "failed computing SHA256 hash");
-        ThrowErrorIf(Error::Unexpected, (resultLength != sizeof(hashLength)), "failed computing SHA256 hash");
-
-        // Size the hash buffer appropriately
-        hash.resize(hashLength);
+        ThrowErrorIf(Error::Unexpected, (resultLength != sizeof(m_context->hashLength)), "failed computing SHA256 hash");
 
         // Create a hash handle
         ThrowStatusIfFailed(BCryptCreateHash(
-            algHandle.get(),            // Handle to an algorithm provider                 
+            m_context->algHandle.get(), // Handle to an algorithm provider
             &hashHandleT,               // A pointer to a hash handle - can be a hash or hmac object
             nullptr,                    // Pointer to the buffer that receives the hash/hmac object
             0,                          // Size of the buffer in bytes
@@ -85,24 +87,41 @@ namespace MSIX {
             0,                          // Size of the key in bytes
             0),                         // Flags
         "failed computing SHA256 hash");
+        m_context->hashHandle.reset(hashHandleT);
+    }
+
+    SHA256::~SHA256() {}
 
+    void SHA256::Update(const std::uint8_t* buffer, std::uint32_t cbBuffer)
+    {
         // Hash the message(s)
-        unique_hash_handle hashHandle(hashHandleT);
         ThrowStatusIfFailed(BCryptHashData(
-            hashHandle.get(),           // Handle to the hash or MAC object
+            m_context->hashHandle.get(), // Handle to the hash or MAC object
             (PBYTE)buffer,              // A pointer to a buffer that contains the data to hash
             cbBuffer,                   // Size of the buffer in bytes
             0),                         // Flags
         "failed computing SHA256 hash");
+    }
+
+    void SHA256::FinalizeAndGetHashValue(std::vector<std::uint8_t>& hash)
+    {
+        // Size the hash buffer appropriately
+        hash.resize(m_context->hashLength);
 
         // Obtain the hash of the message(s) into the hash buffer
         ThrowStatusIfFailed(BCryptFinishHash(
-            hashHandle.get(),           // Handle to the hash or MAC object
+            m_context->hashHandle.get(), // Handle to the hash or MAC object
             hash.data(),                // A pointer to a buffer that receives the hash or MAC value
-            hashLength,                 // Size of the buffer in bytes
+            m_context->hashLength,      // Size of the buffer in bytes
             0),                         // Flags
         "failed computing SHA256 hash");
+    }
 
+    bool SHA256::ComputeHash(std::uint8_t* buffer, std::uint32_t cbBuffer, std::vector<uint8_t>& hash)
+    {
+        SHA256 sha256;
+        sha256.Update(buffer, cbBuffer);
+        sha256.FinalizeAndGetHashValue(hash);
         return true;
     }
 }
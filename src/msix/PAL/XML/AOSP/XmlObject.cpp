@@ -65,6 +65,11 @@ public:
         return GetBase64DecodedValue(intermediate);
     }
 
+    bool GetBase64DecodedAttributeValue(XmlAttributeName attribute, std::uint8_t* buffer, std::size_t size) override
+    {
+        return GetBase64DecodedValue(GetAttributeValue(attribute), buffer, size);
+    }
+
     std::string GetText() override
     {
         std::unique_ptr<_jstring, JObjectDeleter> jvalue(reinterpret_cast<jstring>(m_env->CallObjectMethod(m_javaXmlElementObject.get(), getTextContentFunc)));
@@ -239,6 +244,11 @@ public:
     {
         return ComPtr<IXmlDom>::Make<JavaXmlDom>(m_factory, stream);
     }
+
+    bool ParseFromStream(XmlContentType footPrintType, const ComPtr<IStream>& stream, XmlElementHandler& handler) override
+    {   // Not implemented for this parser, the DOM is used instead.
+        return false;
+    }
 protected:
     IMsixFactory* m_factory;
 };
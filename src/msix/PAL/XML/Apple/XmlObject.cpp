@@ -52,6 +52,11 @@ public:
         return GetBase64DecodedValue(intermediate);
     }
 
+    bool GetBase64DecodedAttributeValue(XmlAttributeName attribute, std::uint8_t* buffer, std::size_t size) override
+    {
+        return GetBase64DecodedValue(GetAttributeValue(attribute), buffer, size);
+    }
+
     std::string GetText() override
     {
         return m_xmlNode->Text;
@@ -164,6 +169,11 @@ public:
     {
         return ComPtr<IXmlDom>::Make<XmlDom>(m_factory, stream);
     }
+
+    bool ParseFromStream(XmlContentType footPrintType, const ComPtr<IStream>& stream, XmlElementHandler& handler) override
+    {   // Not implemented for this parser, the DOM is used instead.
+        return false;
+    }
 protected:
     IMsixFactory* m_factory;
 };
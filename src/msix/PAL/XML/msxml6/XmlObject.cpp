@@ -228,6 +228,11 @@ public:
         return GetBase64DecodedValue(intermediate);
     }
 
+    bool GetBase64DecodedAttributeValue(XmlAttributeName attribute, std::uint8_t* buffer, std::size_t size) override
+    {
+        return GetBase64DecodedValue(GetAttributeValue(attribute), buffer, size);
+    }
+
     std::string GetText() override
     {
         ComPtr<IXMLDOMNode> node;
@@ -594,6 +599,11 @@ public:
             HasIgnorableNamespaces);
     }
 
+    bool ParseFromStream(XmlContentType footPrintType, const ComPtr<IStream>& stream, XmlElementHandler& handler) override
+    {   // Not implemented for MSXML, the DOM is used instead.
+        return false;
+    }
+
 protected:
     bool            m_CoInitialized;
     IMsixFactory*   m_factory;
@@ -0,0 +1,172 @@
+//
+//  Copyright (C) 2017 Microsoft.  All rights reserved.
+//  See LICENSE file in the project root for full license information.
+//
+// Build tool. Compiles the schemas of the footprint files the same way XercesFactory::GetGrammarPool does and
+// writes the grammar pools, serialized with XMLGrammarPool::serializeGrammars, to a header that is compiled
+// into the library. Every argument that isn't an .xsd starts the schemas of a Resource::Type.
+//     msixgrammars <header> <Resource::Type> <schema>... [<Resource::Type> <schema>...]
+#include <memory>
+#include <string>
+#include <vector>
+#include <utility>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+
+#include "xercesc/framework/BinOutputStream.hpp"
+#include "xercesc/framework/MemBufInputSource.hpp"
+#include "xercesc/framework/XMLGrammarPoolImpl.hpp"
+#include "xercesc/parsers/XercesDOMParser.hpp"
+#include "xercesc/util/PlatformUtils.hpp"
+#include "xercesc/util/XMLString.hpp"
+
+XERCES_CPP_NAMESPACE_USE
+
+class VectorOutputStream final : public BinOutputStream
+{
+public:
+    VectorOutputStream(std::vector<XMLByte>& data) : m_data(data) {}
+
+    XMLFilePos curPos() const override { return m_data.size(); }
+
+    void writeBytes(const XMLByte* const toGo, const XMLSize_t maxToWrite) override
+    {
+        m_data.insert(m_data.end(), toGo, toGo + maxToWrite);
+    }
+
+protected:
+    std::vector<XMLByte>& m_data;
+};
+
+static bool IsSchema(const std::string& argument)
+{
+    const std::string extension = ".xsd";
+    return (argument.size() > extension.size()) &&
+        (argument.compare(argument.size() - extension.size(), extension.size(), extension) == 0);
+}
+
+static std::vector<XMLByte> SerializeGrammars(const std::vector<std::string>& schemas)
+{
+    XMLGrammarPoolImpl pool(XMLPlatformUtils::fgMemoryManager);
+    {
+        XercesDOMParser parser(nullptr, XMLPlatformUtils::fgMemoryManager, &pool);
+        parser.setDoSchema(true);
+        parser.setDoNamespaces(true);
+        parser.setHandleMultipleImports(true);
+        parser.setValidationSchemaFullChecking(true);
+        for (const auto& schema : schemas)
+        {
+            std::ifstream file(schema, std::ios::binary);
+            if (!file) { throw std::runtime_error("can't open " + schema); }
+            std::vector<char> schemaBuffer((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            MemBufInputSource item(reinterpret_cast<const XMLByte*>(schemaBuffer.data()), schemaBuffer.size(), "Schema");
+            parser.loadGrammar(item, Grammar::GrammarType::SchemaGrammarType, true);
+        }
+    }
+    // Serialized unlocked, the library locks the pool once it's deserialized.
+    std::vector<XMLByte> result;
+    VectorOutputStream stream(result);
+    pool.serializeGrammars(&stream);
+    return result;
+}
+
+static void WriteHeader(std::ostream& header, const std::vector<std::pair<std::string, std::vector<XMLByte>>>& grammars)
+{
+    header << "//\n"
+              "//  Copyright (C) 2017 Microsoft.  All rights reserved.\n"
+              "//  See LICENSE file in the project root for full license information.\n"
+              "// \n"
+              "//  This file is generated by msixgrammars. Do not edit.\n"
+              "//\n"
+              "#pragma once\n"
+              "#include \"MSIXResource.hpp\"\n"
+              "\n"
+              "namespace MSIX {\n"
+              "    namespace Grammars {\n";
+    for (const auto& grammar : grammars)
+    {
+        header << "        const std::uint8_t " << grammar.first << "[" << grammar.second.size() << "] = {";
+        const char* digits = "0123456789abcdef";
+        for (std::size_t i = 0; i < grammar.second.size(); i++)
+        {
+            header << ((i % 16 == 0) ? "\n            " : " ") << "0x" << digits[grammar.second[i] >> 4] << digits[grammar.second[i] & 0xf] << ",";
+        }
+        header << "};\n";
+    }
+    header << "    }\n"
+              "\n"
+              "    // The grammar pool of the schemas of a resource, serialized by XMLGrammarPool::serializeGrammars.\n"
+              "    inline bool GetSerializedGrammars(Resource::Type type, const std::uint8_t** data, std::size_t* size)\n"
+              "    {\n"
+              "        switch(type)\n"
+              "        {\n";
+    for (const auto& grammar : grammars)
+    {
+        header << "            case Resource::" << grammar.first << ":\n"
+               << "                *data = Grammars::" << grammar.first << ";\n"
+               << "                *size = sizeof(Grammars::" << grammar.first << ");\n"
+               << "                return true;\n";
+    }
+    header << "            default:\n"
+              "                return false;\n"
+              "        }\n"
+              "    }\n"
+              "}\n";
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        std::cerr << "usage: " << argv[0] << " <header> <Resource::Type> <schema>... [<Resource::Type> <schema>...]" << std::endl;
+        return 1;
+    }
+
+    XMLPlatformUtils::Initialize();
+    int result = 0;
+    try
+    {
+        std::vector<std::pair<std::string, std::vector<std::string>>> resources;
+        for (int i = 2; i < argc; i++)
+        {
+            std::string argument(argv[i]);
+            if (!IsSchema(argument))
+            {   resources.emplace_back(argument, std::vector<std::string>());
+            }
+            else if (resources.empty())
+            {   throw std::runtime_error(argument + " doesn't belong to a resource type");
+            }
+            else
+            {   resources.back().second.push_back(argument);
+            }
+        }
+
+        std::vector<std::pair<std::string, std::vector<XMLByte>>> grammars;
+        for (const auto& resource : resources)
+        {
+            if (!resource.second.empty())
+            {   grammars.emplace_back(resource.first, SerializeGrammars(resource.second));
+            }
+        }
+
+        std::ofstream header(argv[1], std::ios::binary | std::ios::trunc);
+        if (!header) { throw std::runtime_error(std::string("can't create ") + argv[1]); }
+        WriteHeader(header, grammars);
+    }
+    catch (const XMLException& e)
+    {
+        char* message = XMLString::transcode(e.getMessage());
+        std::cerr << argv[0] << ": " << message << std::endl;
+        XMLString::release(&message);
+        result = 1;
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << argv[0] << ": " << e.what() << std::endl;
+        result = 1;
+    }
+    XMLPlatformUtils::Terminate();
+    return result;
+}
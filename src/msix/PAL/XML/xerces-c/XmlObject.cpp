@@ -6,6 +6,9 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <mutex>
+#include <algorithm>
+#include <limits>
 
 #include "Exceptions.hpp"
 #include "StreamBase.hpp"
@@ -14,6 +17,10 @@
 #include "MSIXResource.hpp"
 #include "UnicodeConversion.hpp"
 #include "Enumerators.hpp"
+#include "Encoding.hpp"
+#ifdef SERIALIZED_GRAMMARS
+#include "MSIXGrammars.hpp"
+#endif
 
 // Mandatory for using any feature of Xerces.
 #include "xercesc/dom/DOM.hpp"
@@ -22,9 +29,17 @@
 #include "xercesc/parsers/AbstractDOMParser.hpp"
 #include "xercesc/parsers/XercesDOMParser.hpp"
 #include "xercesc/sax/ErrorHandler.hpp"
+#include "xercesc/sax/InputSource.hpp"
+#include "xercesc/sax2/Attributes.hpp"
+#include "xercesc/sax2/DefaultHandler.hpp"
+#include "xercesc/sax2/SAX2XMLReader.hpp"
+#include "xercesc/sax2/XMLReaderFactory.hpp"
+#include "xercesc/util/BinInputStream.hpp"
 #include "xercesc/util/PlatformUtils.hpp"
 #include "xercesc/util/XMLString.hpp"
+#include "xercesc/util/XMLUni.hpp"
 #include "xercesc/util/Base64.hpp"
+#include "xercesc/util/BinMemInputStream.hpp"
 
 XERCES_CPP_NAMESPACE_USE
 
@@ -204,42 +219,160 @@ protected:
     XMLByte* m_ptr = nullptr;             
 };    
 
+// The attributeNames, transcoded the first time they're needed.
+static const XMLCh* GetAttributeName(XmlAttributeName attribute)
+{
+    static const std::vector<std::basic_string<XMLCh>> names = []()
+    {
+        std::vector<std::basic_string<XMLCh>> result;
+        for (const auto& name : attributeNames)
+        {
+            XercesXMLChPtr xmlName(XMLString::transcode(utf16_to_utf8(name).c_str()));
+            result.emplace_back(xmlName.Get());
+        }
+        return result;
+    }();
+    return names.at(static_cast<std::size_t>(attribute)).c_str();
+}
+
+// Values are nearly always ASCII and copied straight into the string, anything else is transcoded.
+static std::string GetString(const XMLCh* value)
+{
+    std::string result(XMLString::stringLen(value), '\0');
+    for (std::size_t i = 0; i < result.size(); i++)
+    {
+        if (value[i] >= 0x80)
+        {
+            XercesCharPtr transcoded(XMLString::transcode(value));
+            return std::string(transcoded.Get());
+        }
+        result[i] = static_cast<char>(value[i]);
+    }
+    return result;
+}
+
+static std::vector<std::uint8_t> GetBase64DecodedValue(const XMLCh* value)
+{
+    XMLSize_t len = 0;
+    XercesXMLBytePtr decodedData(XERCES_CPP_NAMESPACE::Base64::decodeToXMLByte(value, &len));
+    return std::vector<std::uint8_t>(decodedData.Get(), decodedData.Get() + len);
+}
+
+// DecodeBase64 takes the canonical encoding, which is what's always there. Anything else, like values with
+// whitespace, goes through Base64::decodeToXMLByte.
+static bool GetBase64DecodedValue(const XMLCh* value, std::uint8_t* buffer, std::size_t size)
+{
+    if (DecodeBase64(value, XMLString::stringLen(value), buffer, size))
+    {   return true;
+    }
+    auto decoded = GetBase64DecodedValue(value);
+    if (decoded.size() != size)
+    {   return false;
+    }
+    std::copy(decoded.begin(), decoded.end(), buffer);
+    return true;
+}
+
+// A location path made only of child steps, like all the xPaths are, e.g. "/Package/Identity" or "./Block".
+// Selects the same elements DOMDocument::evaluate does by walking the DOM, instead of compiling and
+// evaluating the expression each time it's used.
+class XercesPath
+{
+public:
+    // Returns false if path isn't made only of child steps, it has to be evaluated then.
+    bool Compile(const std::string& path)
+    {
+        m_steps.clear();
+        m_absolute = (path.compare(0, 1, "/") == 0);
+        std::size_t position = m_absolute ? 1 : ((path.compare(0, 2, "./") == 0) ? 2 : 0);
+        while (position <= path.size())
+        {
+            auto end = std::min(path.find('/', position), path.size());
+            auto step = path.substr(position, end - position);
+            if (step.empty() || (step.find_first_of("*:.@[]()|=$ ") != std::string::npos))
+            {   return false;
+            }
+            XercesXMLChPtr name(XMLString::transcode(step.c_str()));
+            m_steps.emplace_back(name.Get());
+            position = end + 1;
+        }
+        return true;
+    }
+
+    // Calls visit with each element selected from context, in document order, until it returns false.
+    template<class Visit>
+    bool ForEach(DOMElement* context, Visit&& visit) const
+    {
+        if (m_absolute)
+        {
+            auto root = context->getOwnerDocument()->getDocumentElement();
+            if (!Matches(root, m_steps[0])) { return true; }
+            return (m_steps.size() == 1) ? visit(root) : ForEachChild(root, 1, visit);
+        }
+        return ForEachChild(context, 0, visit);
+    }
+
+protected:
+    // As evaluate does for a step without a prefix: the qualified name of the element must match, unless
+    // the document was parsed without namespaces, then its prefix is ignored.
+    static bool Matches(const DOMElement* element, const std::basic_string<XMLCh>& step)
+    {
+        auto name = element->getTagName();
+        if (element->getPrefix() == nullptr)
+        {
+            auto colon = XMLString::indexOf(name, chColon);
+            if (colon != -1) { name += colon + 1; }
+        }
+        return XMLString::equals(name, step.c_str());
+    }
+
+    template<class Visit>
+    bool ForEachChild(DOMElement* parent, std::size_t step, Visit& visit) const
+    {
+        for (auto child = parent->getFirstElementChild(); child != nullptr; child = child->getNextElementSibling())
+        {
+            if (Matches(child, m_steps[step]))
+            {
+                if (!((step + 1 == m_steps.size()) ? visit(child) : ForEachChild(child, step + 1, visit)))
+                {   return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    bool m_absolute = false;
+    std::vector<std::basic_string<XMLCh>> m_steps;
+};
+
 class XercesElement final : public ComClass<XercesElement, IXmlElement, IXercesElement, IMsixElement>
 {
 private:
     std::string GetAttributeValue(std::string& attributeName)
     {
         XercesXMLChPtr nameAttr(XMLString::transcode(attributeName.c_str()));
-        XercesCharPtr value(XMLString::transcode(m_element->getAttribute(nameAttr.Get())));
-        return std::string(value.Get());
+        return GetString(m_element->getAttribute(nameAttr.Get()));
     }
 
 public:
     XercesElement(IMsixFactory* factory, DOMElement* element, XERCES_CPP_NAMESPACE::XercesDOMParser* parser) :
         m_factory(factory), m_element(element), m_parser(parser)
-    {
-        m_resolver = XercesPtr<DOMXPathNSResolver>(m_parser->getDocument()->createNSResolver(m_parser->getDocument()));
-    }
+    {}
     
     // IXmlElement
     std::string GetAttributeValue(XmlAttributeName attribute) override
     {
-        auto attributeName = utf16_to_utf8(attributeNames[static_cast<uint8_t>(attribute)]);
-        return GetAttributeValue(attributeName);
+        return GetString(m_element->getAttribute(GetAttributeName(attribute)));
     }
 
     std::vector<std::uint8_t> GetBase64DecodedAttributeValue(XmlAttributeName attribute) override
     {
-        XercesXMLChPtr nameAttr(XMLString::transcode(utf16_to_utf8(attributeNames[static_cast<uint8_t>(attribute)]).c_str()));
-        XMLSize_t len = 0;
-        XercesXMLBytePtr decodedData(XERCES_CPP_NAMESPACE::Base64::decodeToXMLByte(
-            m_element->getAttribute(nameAttr.Get()),
-            &len));
-        std::vector<std::uint8_t> result(len);
-        for(XMLSize_t index=0; index < len; index++)
-        {   result[index] = static_cast<std::uint8_t>(decodedData.Get()[index]);
-        }
-        return result;
+        return GetBase64DecodedValue(m_element->getAttribute(GetAttributeName(attribute)));
+    }
+
+    bool GetBase64DecodedAttributeValue(XmlAttributeName attribute, std::uint8_t* buffer, std::size_t size) override
+    {
+        return GetBase64DecodedValue(m_element->getAttribute(GetAttributeName(attribute)), buffer, size);
     }
 
     std::string GetText() override
@@ -272,24 +405,37 @@ public:
     {
         ThrowErrorIf(Error::InvalidParameter, (elements == nullptr || *elements != nullptr), "bad pointer.");
 
-        // Note: getElementsByTagName only returns the childs of a DOMElement and doesn't 
-        // support xPath. For this reason we need the XercesDomParser in this object.
         auto intermediate = utf16_to_utf8(name);
-        XercesXMLChPtr xPath(XMLString::transcode(intermediate.c_str()));
-        XercesPtr<DOMXPathResult> result(m_parser->getDocument()->evaluate(
-            xPath.Get(),
-            m_element,
-            m_resolver.Get(),
-            DOMXPathResult::ORDERED_NODE_SNAPSHOT_TYPE,
-            nullptr));
-
         std::vector<ComPtr<IMsixElement>> elementsEnum;
-        for (XMLSize_t i = 0; i < result->getSnapshotLength(); i++)
+        XercesPath path;
+        if (path.Compile(intermediate))
+        {
+            path.ForEach(m_element, [&](DOMElement* element)
+            {
+                elementsEnum.push_back(ComPtr<IMsixElement>::Make<XercesElement>(m_factory, element, m_parser));
+                return true;
+            });
+        }
+        else
         {
-            result->snapshotItem(i);
-            auto node = static_cast<DOMElement*>(result->getNodeValue());
-            auto item = ComPtr<IMsixElement>::Make<XercesElement>(m_factory, node, m_parser);
-            elementsEnum.push_back(std::move(item));
+            // Note: getElementsByTagName only returns the childs of a DOMElement and doesn't 
+            // support xPath. For this reason we need the XercesDomParser in this object.
+            XercesPtr<DOMXPathNSResolver> resolver(m_parser->getDocument()->createNSResolver(m_parser->getDocument()));
+            XercesXMLChPtr xPath(XMLString::transcode(intermediate.c_str()));
+            XercesPtr<DOMXPathResult> result(m_parser->getDocument()->evaluate(
+                xPath.Get(),
+                m_element,
+                resolver.Get(),
+                DOMXPathResult::ORDERED_NODE_SNAPSHOT_TYPE,
+                nullptr));
+
+            for (XMLSize_t i = 0; i < result->getSnapshotLength(); i++)
+            {
+                result->snapshotItem(i);
+                auto node = static_cast<DOMElement*>(result->getNodeValue());
+                auto item = ComPtr<IMsixElement>::Make<XercesElement>(m_factory, node, m_parser);
+                elementsEnum.push_back(std::move(item));
+            }
         }
         *elements = ComPtr<IMsixElementEnumerator>::
             Make<EnumeratorCom<IMsixElementEnumerator,IMsixElement>>(elementsEnum).Detach();
@@ -300,31 +446,30 @@ protected:
     IMsixFactory* m_factory = nullptr;
     DOMElement* m_element = nullptr;
     XERCES_CPP_NAMESPACE::XercesDOMParser* m_parser;
-    XercesPtr<DOMXPathNSResolver> m_resolver;
 };
 
 class XercesDom final : public ComClass<XercesDom, IXmlDom>
 {
 public:
-    XercesDom(IMsixFactory* factory, const ComPtr<IStream>& stream, std::vector<ComPtr<IStream>>* schemas = nullptr) :
-        m_factory(factory), m_stream(stream)
+    // grammarPool holds the compiled schemas to validate against, see XercesFactory::GetGrammarPool. Without
+    // it the stream is only checked to be well-formed xml.
+    XercesDom(IMsixFactory* factory, const ComPtr<IStream>& stream, const std::shared_ptr<XERCES_CPP_NAMESPACE::XMLGrammarPool>& grammarPool = nullptr) :
+        m_factory(factory), m_grammarPool(grammarPool), m_stream(stream)
     {
         auto buffer = Helper::CreateBufferFromStream(stream);
         std::unique_ptr<XERCES_CPP_NAMESPACE::MemBufInputSource> source = std::make_unique<XERCES_CPP_NAMESPACE::MemBufInputSource>(
             reinterpret_cast<const XMLByte*>(&buffer[0]), buffer.size(), "XML File");
 
-        // Create parser and grammar pool
-        auto grammarPool = std::make_unique<XERCES_CPP_NAMESPACE::XMLGrammarPoolImpl>(XERCES_CPP_NAMESPACE::XMLPlatformUtils::fgMemoryManager);
-        m_parser = std::make_unique<XERCES_CPP_NAMESPACE::XercesDOMParser>(nullptr, XERCES_CPP_NAMESPACE::XMLPlatformUtils::fgMemoryManager, grammarPool.get());
-        
-        // For Non validation parser GetResources will return an empty vector for the ContentType, BlockMap and AppxBundleManifest.
-        // XercesDom will only parse the schemas if the vector is not empty. If not, it will only see that it is valid xml.
-        bool HasSchemas = ((schemas != nullptr) && (schemas->begin() != schemas->end()));
+        // Create parser
+        m_parser = std::make_unique<XERCES_CPP_NAMESPACE::XercesDOMParser>(nullptr, XERCES_CPP_NAMESPACE::XMLPlatformUtils::fgMemoryManager, m_grammarPool.get());
+
+        bool HasSchemas = (m_grammarPool != nullptr);
         m_parser->setValidationScheme(HasSchemas ? 
             XERCES_CPP_NAMESPACE::AbstractDOMParser::ValSchemes::Val_Always : 
             XERCES_CPP_NAMESPACE::AbstractDOMParser::ValSchemes::Val_Never
         );
-        m_parser->cacheGrammarFromParse(HasSchemas);            
+        // The pool is shared and locked, the grammars are only read from it.
+        m_parser->useCachedGrammarInParse(HasSchemas);
         m_parser->setDoSchema(HasSchemas);
         m_parser->setDoNamespaces(HasSchemas);
         m_parser->setHandleMultipleImports(HasSchemas); // TODO: do we need to handle the case where there aren't multiple schemas with the same namespace?
@@ -337,22 +482,10 @@ public:
             m_parser->setCreateEntityReferenceNodes(false);
         }
 
-        // Add schemas
-        if (HasSchemas)
-        {   for(auto& schema : *schemas)
-            {   auto schemaBuffer = Helper::CreateBufferFromStream(schema);
-                auto item = std::make_unique<XERCES_CPP_NAMESPACE::MemBufInputSource>(
-                    reinterpret_cast<const XMLByte*>(&schemaBuffer[0]), schemaBuffer.size(), "Schema");
-                m_parser->loadGrammar(*item, XERCES_CPP_NAMESPACE::Grammar::GrammarType::SchemaGrammarType, true);
-            }           
-        }
-
         // Set the error handler for the parser
         auto errorHandler = std::make_unique<ParsingException>();
         m_parser->setErrorHandler(errorHandler.get());
         m_parser->parse(*source);
-
-        m_resolver = XercesPtr<DOMXPathNSResolver>(m_parser->getDocument()->createNSResolver(m_parser->getDocument()));
     }
 
     // IXmlDom
@@ -364,46 +497,167 @@ public:
     bool ForEachElementIn(const ComPtr<IXmlElement>& root, XmlQueryName query, XmlVisitor& visitor) override
     {
         ComPtr<IXercesElement> element = root.As<IXercesElement>();
-
-        XercesXMLChPtr xPath(XMLString::transcode(xPaths[static_cast<uint8_t>(query)]));
-        XercesPtr<DOMXPathResult> result(m_parser->getDocument()->evaluate(
-            xPath.Get(),
-            element->GetElement(),
-            m_resolver.Get(),
-            DOMXPathResult::ORDERED_NODE_SNAPSHOT_TYPE,
-            nullptr));
-        
-        for (XMLSize_t i = 0; i < result->getSnapshotLength(); i++)
+        return GetPath(query).ForEach(element->GetElement(), [&](DOMElement* node)
         {
-            result->snapshotItem(i);
-            auto node = static_cast<DOMElement*>(result->getNodeValue());
             auto item = ComPtr<IXmlElement>::Make<XercesElement>(m_factory, node, m_parser.get());
-            if (!visitor.Callback(visitor.context, item))
-            {
-                return false;
-            }
-        }
-        return true;
+            return visitor.Callback(visitor.context, item);
+        });
     }
 
 protected:
+    // The xPaths, compiled the first time a query is made.
+    static const XercesPath& GetPath(XmlQueryName query)
+    {
+        static const std::vector<XercesPath> paths = []()
+        {
+            std::vector<XercesPath> result(sizeof(xPaths) / sizeof(xPaths[0]));
+            for (std::size_t i = 0; i < result.size(); i++)
+            {   ThrowErrorIfNot(Error::Unexpected, result[i].Compile(xPaths[i]), "xPath is not made of child steps");
+            }
+            return result;
+        }();
+        return paths.at(static_cast<std::size_t>(query));
+    }
+
     IMsixFactory* m_factory;
+    // Declared before m_parser, which uses it until it's destroyed.
+    std::shared_ptr<XERCES_CPP_NAMESPACE::XMLGrammarPool> m_grammarPool;
     std::unique_ptr<XERCES_CPP_NAMESPACE::XercesDOMParser> m_parser;
-    XercesPtr<DOMXPathNSResolver> m_resolver;
     ComPtr<IStream> m_stream;
 };
 
+// Feeds the parser from the stream in the chunks it asks for, instead of from a copy of the whole file.
+class XercesStreamInputStream final : public XERCES_CPP_NAMESPACE::BinInputStream
+{
+public:
+    XercesStreamInputStream(const ComPtr<IStream>& stream) : m_stream(stream) {}
+
+    XMLFilePos curPos() const override { return m_position; }
+
+    XMLSize_t readBytes(XMLByte* const toFill, const XMLSize_t maxToRead) override
+    {
+        ULONG bytesRead = 0;
+        ThrowHrIfFailed(m_stream->Read(toFill, static_cast<ULONG>(std::min<XMLSize_t>(maxToRead, std::numeric_limits<ULONG>::max())), &bytesRead));
+        m_position += bytesRead;
+        return bytesRead;
+    }
+
+    const XMLCh* getContentType() const override { return nullptr; }
+
+protected:
+    ComPtr<IStream> m_stream;
+    XMLFilePos m_position = 0;
+};
+
+class XercesStreamInputSource final : public XERCES_CPP_NAMESPACE::InputSource
+{
+public:
+    XercesStreamInputSource(const ComPtr<IStream>& stream) : InputSource("XML File"), m_stream(stream) {}
+
+    XERCES_CPP_NAMESPACE::BinInputStream* makeStream() const override
+    {
+        return new (getMemoryManager()) XercesStreamInputStream(m_stream);
+    }
+
+protected:
+    ComPtr<IStream> m_stream;
+};
+
+// The element being parsed by XercesSaxHandler. The same object is handed out for every element, it only
+// reads the attributes of the current one.
+class XercesSaxElement final : public ComClass<XercesSaxElement, IXmlElement>
+{
+public:
+    void SetAttributes(const XERCES_CPP_NAMESPACE::Attributes* attributes) { m_attributes = attributes; }
+
+    // IXmlElement
+    std::string GetAttributeValue(XmlAttributeName attribute) override
+    {
+        return GetString(GetValue(attribute));
+    }
+
+    std::vector<std::uint8_t> GetBase64DecodedAttributeValue(XmlAttributeName attribute) override
+    {
+        return GetBase64DecodedValue(GetValue(attribute));
+    }
+
+    bool GetBase64DecodedAttributeValue(XmlAttributeName attribute, std::uint8_t* buffer, std::size_t size) override
+    {
+        return GetBase64DecodedValue(GetValue(attribute), buffer, size);
+    }
+
+    std::string GetText() override { NOTSUPPORTED; }
+
+protected:
+    // Missing attributes are empty, as DOMElement::getAttribute returns them.
+    const XMLCh* GetValue(XmlAttributeName attribute)
+    {
+        ThrowErrorIf(Error::Unexpected, (m_attributes == nullptr), "element read outside of its StartElement");
+        auto value = m_attributes->getValue(GetAttributeName(attribute));
+        return (value != nullptr) ? value : XERCES_CPP_NAMESPACE::XMLUni::fgZeroLenString;
+    }
+
+    const XERCES_CPP_NAMESPACE::Attributes* m_attributes = nullptr;
+};
+
+class XercesSaxHandler final : public XERCES_CPP_NAMESPACE::DefaultHandler
+{
+public:
+    XercesSaxHandler(XmlElementHandler& handler) : m_handler(handler)
+    {
+        m_element = ComPtr<XercesSaxElement>::Make<XercesSaxElement>();
+        m_elementInterface = m_element.As<IXmlElement>();
+    }
+
+    void startElement(const XMLCh* const uri, const XMLCh* const localname, const XMLCh* const qname,
+        const XERCES_CPP_NAMESPACE::Attributes& attributes) override
+    {
+        m_element->SetAttributes(&attributes);
+        m_handler.StartElement(m_depth, GetLocalName(qname), m_elementInterface);
+        m_element->SetAttributes(nullptr);
+        m_depth++;
+    }
+
+    void endElement(const XMLCh* const uri, const XMLCh* const localname, const XMLCh* const qname) override
+    {
+        m_depth--;
+        m_handler.EndElement(m_depth, GetLocalName(qname));
+    }
+
+protected:
+    // The qualified name is reported with or without namespace processing, unlike localname.
+    static std::string GetLocalName(const XMLCh* qname)
+    {
+        auto separator = XMLString::indexOf(qname, XERCES_CPP_NAMESPACE::chColon);
+        XercesCharPtr name(XMLString::transcode(qname + separator + 1));
+        return std::string(name.Get());
+    }
+
+    XmlElementHandler& m_handler;
+    ComPtr<XercesSaxElement> m_element;
+    ComPtr<IXmlElement> m_elementInterface;
+    std::size_t m_depth = 0;
+};
+
 class XercesFactory final : public ComClass<XercesFactory, IXmlFactory>
 {
 public:
     XercesFactory(IMsixFactory* factory) : m_factory(factory)
     {
-        XERCES_CPP_NAMESPACE::XMLPlatformUtils::Initialize();
+        std::lock_guard<std::mutex> lock(s_platformLock);
+        if (s_platformUsers == 0)
+        {   XERCES_CPP_NAMESPACE::XMLPlatformUtils::Initialize();
+        }
+        s_platformUsers++;
     }
 
     ~XercesFactory()
     {
-        XERCES_CPP_NAMESPACE::XMLPlatformUtils::Terminate();
+        std::lock_guard<std::mutex> lock(s_platformLock);
+        if (--s_platformUsers == 0)
+        {   s_grammarPools.clear();
+            XERCES_CPP_NAMESPACE::XMLPlatformUtils::Terminate();
+        }
     }
 
     ComPtr<IXmlDom> CreateDomFromStream(XmlContentType footPrintType, const ComPtr<IStream>& stream) override
@@ -411,16 +665,12 @@ public:
         switch (footPrintType)
         {
             case XmlContentType::AppxBlockMapXml:
-            {   auto blockMapSchema = GetResources(m_factory, Resource::Type::BlockMap);
-                return ComPtr<IXmlDom>::Make<XercesDom>(m_factory, stream, &blockMapSchema);
-            }
+                return ComPtr<IXmlDom>::Make<XercesDom>(m_factory, stream, GetGrammarPool(Resource::Type::BlockMap));
             case XmlContentType::AppxManifestXml:
                 // TODO: pass schemas to validate AppxManifest. This only validates that is a well-formed xml
                 return ComPtr<IXmlDom>::Make<XercesDom>(m_factory, stream);
             case XmlContentType::ContentTypeXml:
-            {   auto contentTypeSchema = GetResources(m_factory, Resource::Type::ContentType);
-                return ComPtr<IXmlDom>::Make<XercesDom>(m_factory, stream, &contentTypeSchema);
-            }
+                return ComPtr<IXmlDom>::Make<XercesDom>(m_factory, stream, GetGrammarPool(Resource::Type::ContentType));
             case XmlContentType::AppxBundleManifestXml:
             {   // TODO: pass schemas to validate AppxManifest. This only validates that is a well-formed xml
                 return ComPtr<IXmlDom>::Make<XercesDom>(m_factory, stream);
@@ -428,10 +678,111 @@ public:
         }
         ThrowError(Error::InvalidParameter);
     }
+
+    bool ParseFromStream(XmlContentType footPrintType, const ComPtr<IStream>& stream, XmlElementHandler& handler) override
+    {
+        std::shared_ptr<XERCES_CPP_NAMESPACE::XMLGrammarPool> grammarPool;
+        if (footPrintType == XmlContentType::AppxBlockMapXml)
+        {   grammarPool = GetGrammarPool(Resource::Type::BlockMap);
+        }
+        else if (footPrintType == XmlContentType::ContentTypeXml)
+        {   grammarPool = GetGrammarPool(Resource::Type::ContentType);
+        }
+
+        // Same settings as the XercesDOMParser of XercesDom.
+        std::unique_ptr<XERCES_CPP_NAMESPACE::SAX2XMLReader> reader(XERCES_CPP_NAMESPACE::XMLReaderFactory::createXMLReader(
+            XERCES_CPP_NAMESPACE::XMLPlatformUtils::fgMemoryManager, grammarPool.get()));
+        bool HasSchemas = (grammarPool != nullptr);
+        reader->setFeature(XERCES_CPP_NAMESPACE::XMLUni::fgSAX2CoreValidation, HasSchemas);
+        reader->setFeature(XERCES_CPP_NAMESPACE::XMLUni::fgXercesDynamic, false);
+        reader->setFeature(XERCES_CPP_NAMESPACE::XMLUni::fgXercesUseCachedGrammarInParse, HasSchemas);
+        reader->setFeature(XERCES_CPP_NAMESPACE::XMLUni::fgXercesSchema, HasSchemas);
+        reader->setFeature(XERCES_CPP_NAMESPACE::XMLUni::fgSAX2CoreNameSpaces, HasSchemas);
+        reader->setFeature(XERCES_CPP_NAMESPACE::XMLUni::fgXercesHandleMultipleImports, HasSchemas);
+        reader->setFeature(XERCES_CPP_NAMESPACE::XMLUni::fgXercesSchemaFullChecking, HasSchemas);
+        if (HasSchemas)
+        {   // Disable DTD and prevent XXE attacks, see XercesDom.
+            reader->setFeature(XERCES_CPP_NAMESPACE::XMLUni::fgXercesIgnoreCachedDTD, true);
+            reader->setFeature(XERCES_CPP_NAMESPACE::XMLUni::fgXercesSkipDTDValidation, true);
+        }
+
+        XercesSaxHandler saxHandler(handler);
+        ParsingException errorHandler;
+        reader->setContentHandler(&saxHandler);
+        reader->setErrorHandler(&errorHandler);
+
+        LARGE_INTEGER start = { 0 };
+        ThrowHrIfFailed(stream->Seek(start, StreamBase::Reference::START, nullptr));
+        XercesStreamInputSource source(stream);
+        reader->parse(source);
+        // move the stream back to the beginning, as CreateDomFromStream does.
+        ThrowHrIfFailed(stream->Seek(start, StreamBase::Reference::START, nullptr));
+        return true;
+    }
+
 protected:
+    // Compiles the schemas of a footprint file the first time one is parsed, unless the build serialized
+    // them already, and caches them in a grammar pool shared by all the factories while Xerces is initialized.
+    // The pool is locked once the grammars are loaded, which makes it read only and safe to parse with from
+    // any thread. For the non validating parser GetResources returns no schemas, so there is no pool.
+    std::shared_ptr<XERCES_CPP_NAMESPACE::XMLGrammarPool> GetGrammarPool(Resource::Type type)
+    {
+        std::lock_guard<std::mutex> lock(s_platformLock);
+        auto& grammarPool = s_grammarPools[type];
+        if (!grammarPool)
+        {
+            auto pool = std::make_shared<XERCES_CPP_NAMESPACE::XMLGrammarPoolImpl>(XERCES_CPP_NAMESPACE::XMLPlatformUtils::fgMemoryManager);
+            if (!LoadSerializedGrammars(type, *pool))
+            {
+                auto schemas = GetResources(m_factory, type);
+                if (schemas.empty()) { return nullptr; }
+                XERCES_CPP_NAMESPACE::XercesDOMParser parser(nullptr, XERCES_CPP_NAMESPACE::XMLPlatformUtils::fgMemoryManager, pool.get());
+                parser.setDoSchema(true);
+                parser.setDoNamespaces(true);
+                parser.setHandleMultipleImports(true);
+                parser.setValidationSchemaFullChecking(true);
+                for(auto& schema : schemas)
+                {   auto schemaBuffer = Helper::CreateBufferFromStream(schema);
+                    auto item = std::make_unique<XERCES_CPP_NAMESPACE::MemBufInputSource>(
+                        reinterpret_cast<const XMLByte*>(&schemaBuffer[0]), schemaBuffer.size(), "Schema");
+                    parser.loadGrammar(*item, XERCES_CPP_NAMESPACE::Grammar::GrammarType::SchemaGrammarType, true);
+                }
+            }
+            pool->lockPool();
+            grammarPool = pool;
+        }
+        return grammarPool;
+    }
+
+    // Loads the grammars msixgrammars serialized at build time, see SerializeGrammars.cpp.
+    static bool LoadSerializedGrammars(Resource::Type type, XERCES_CPP_NAMESPACE::XMLGrammarPool& pool)
+    {
+        #ifdef SERIALIZED_GRAMMARS
+        const std::uint8_t* grammars = nullptr;
+        std::size_t size = 0;
+        if (GetSerializedGrammars(type, &grammars, &size))
+        {
+            XERCES_CPP_NAMESPACE::BinMemInputStream stream(grammars, size, XERCES_CPP_NAMESPACE::BinMemInputStream::BufOpt_Reference);
+            pool.deserializeGrammars(&stream);
+            return true;
+        }
+        #endif
+        return false;
+    }
+
+    // XMLPlatformUtils counts the calls to Initialize and Terminate without a lock, and factories can be
+    // created and released on any thread. The first factory initializes Xerces and the last one terminates it.
+    static std::mutex  s_platformLock;
+    static std::size_t s_platformUsers;
+    static std::map<Resource::Type, std::shared_ptr<XERCES_CPP_NAMESPACE::XMLGrammarPool>> s_grammarPools;
+
     IMsixFactory* m_factory;
 };
 
+std::mutex  XercesFactory::s_platformLock;
+std::size_t XercesFactory::s_platformUsers = 0;
+std::map<Resource::Type, std::shared_ptr<XERCES_CPP_NAMESPACE::XMLGrammarPool>> XercesFactory::s_grammarPools;
+
 ComPtr<IXmlFactory> CreateXmlFactory(IMsixFactory* factory) { return ComPtr<IXmlFactory>::Make<XercesFactory>(factory); }
 
 } // namespace MSIX
\ No newline at end of file
@@ -0,0 +1,237 @@
+//
+//  Copyright (C) 2017 Microsoft.  All rights reserved.
+//  See LICENSE file in the project root for full license information.
+// 
+#include "Exceptions.hpp"
+#include "SHA256.hpp"
+
+#include <cstring>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define MSIX_SHA256_SHANI
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define SHANI_TARGET
+#else
+#include <cpuid.h>
+#define SHANI_TARGET __attribute__((target("sha,sse4.1")))
+#endif
+#endif
+
+namespace MSIX {
+
+#ifdef MSIX_SHA256_SHANI
+    static const std::uint32_t Sha256RoundConstants[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+    };
+
+    static const std::uint32_t Sha256InitialState[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+
+    static bool IsShaNiSupported()
+    {
+        unsigned int leaf1[4] = { 0 };
+        unsigned int leaf7[4] = { 0 };
+        #ifdef _MSC_VER
+        int regs[4];
+        __cpuid(regs, 0);
+        if (regs[0] < 7) { return false; }
+        __cpuidex(regs, 1, 0);
+        std::memcpy(leaf1, regs, sizeof(leaf1));
+        __cpuidex(regs, 7, 0);
+        std::memcpy(leaf7, regs, sizeof(leaf7));
+        #else
+        if (__get_cpuid_max(0, nullptr) < 7) { return false; }
+        __cpuid_count(1, 0, leaf1[0], leaf1[1], leaf1[2], leaf1[3]);
+        __cpuid_count(7, 0, leaf7[0], leaf7[1], leaf7[2], leaf7[3]);
+        #endif
+        bool ssse3  = (leaf1[2] & (1u << 9)) != 0;
+        bool sse41  = (leaf1[2] & (1u << 19)) != 0;
+        bool sha    = (leaf7[1] & (1u << 29)) != 0;
+        return ssse3 && sse41 && sha;
+    }
+
+    // Four rounds of the compression function with the next four words of the message schedule.
+    SHANI_TARGET static inline void ShaNiRounds(__m128i& abef, __m128i& cdgh, __m128i message, int round)
+    {
+        __m128i words = _mm_add_epi32(message, _mm_loadu_si128(reinterpret_cast<const __m128i*>(&Sha256RoundConstants[round])));
+        cdgh = _mm_sha256rnds2_epu32(cdgh, abef, words);
+        abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(words, 0x0E));
+    }
+
+    // Next four words of the message schedule out of the previous sixteen.
+    SHANI_TARGET static inline __m128i ShaNiSchedule(__m128i w0, __m128i w1, __m128i w2, __m128i w3)
+    {
+        return _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(w0, w1), _mm_alignr_epi8(w3, w2, 4)), w3);
+    }
+
+    // Runs the compression function over blocks 64 byte blocks of each lane. The lanes are independent, they
+    // are only interleaved so the latency of the SHA instructions of one lane is hidden by the other.
+    template <std::size_t Lanes>
+    SHANI_TARGET static void ShaNiCompress(std::uint32_t* state[Lanes], const std::uint8_t* data[Lanes], std::size_t blocks)
+    {
+        const __m128i byteSwap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+        __m128i abef[Lanes], cdgh[Lanes], m0[Lanes], m1[Lanes], m2[Lanes], m3[Lanes];
+
+        for (std::size_t lane = 0; lane < Lanes; lane++)
+        {   // state is A..H, the instructions want ABEF and CDGH
+            __m128i dcba = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(state[lane])), 0xB1);
+            __m128i efgh = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(state[lane] + 4)), 0x1B);
+            abef[lane] = _mm_alignr_epi8(dcba, efgh, 8);
+            cdgh[lane] = _mm_blend_epi16(efgh, dcba, 0xF0);
+        }
+
+        for (std::size_t block = 0; block < blocks; block++)
+        {
+            __m128i abefSave[Lanes], cdghSave[Lanes];
+            for (std::size_t lane = 0; lane < Lanes; lane++)
+            {
+                const __m128i* input = reinterpret_cast<const __m128i*>(data[lane] + block * 64);
+                abefSave[lane] = abef[lane];
+                cdghSave[lane] = cdgh[lane];
+                m0[lane] = _mm_shuffle_epi8(_mm_loadu_si128(input), byteSwap);
+                m1[lane] = _mm_shuffle_epi8(_mm_loadu_si128(input + 1), byteSwap);
+                m2[lane] = _mm_shuffle_epi8(_mm_loadu_si128(input + 2), byteSwap);
+                m3[lane] = _mm_shuffle_epi8(_mm_loadu_si128(input + 3), byteSwap);
+            }
+            for (std::size_t lane = 0; lane < Lanes; lane++) { ShaNiRounds(abef[lane], cdgh[lane], m0[lane], 0); }
+            for (std::size_t lane = 0; lane < Lanes; lane++) { ShaNiRounds(abef[lane], cdgh[lane], m1[lane], 4); }
+            for (std::size_t lane = 0; lane < Lanes; lane++) { ShaNiRounds(abef[lane], cdgh[lane], m2[lane], 8); }
+            for (std::size_t lane = 0; lane < Lanes; lane++) { ShaNiRounds(abef[lane], cdgh[lane], m3[lane], 12); }
+            for (int round = 16; round < 64; round += 16)
+            {
+                for (std::size_t lane = 0; lane < Lanes; lane++)
+                {
+                    m0[lane] = ShaNiSchedule(m0[lane], m1[lane], m2[lane], m3[lane]);
+                    ShaNiRounds(abef[lane], cdgh[lane], m0[lane], round);
+                }
+                for (std::size_t lane = 0; lane < Lanes; lane++)
+                {
+                    m1[lane] = ShaNiSchedule(m1[lane], m2[lane], m3[lane], m0[lane]);
+                    ShaNiRounds(abef[lane], cdgh[lane], m1[lane], round + 4);
+                }
+                for (std::size_t lane = 0; lane < Lanes; lane++)
+                {
+                    m2[lane] = ShaNiSchedule(m2[lane], m3[lane], m0[lane], m1[lane]);
+                    ShaNiRounds(abef[lane], cdgh[lane], m2[lane], round + 8);
+                }
+                for (std::size_t lane = 0; lane < Lanes; lane++)
+                {
+                    m3[lane] = ShaNiSchedule(m3[lane], m0[lane], m1[lane], m2[lane]);
+                    ShaNiRounds(abef[lane], cdgh[lane], m3[lane], round + 12);
+                }
+            }
+            for (std::size_t lane = 0; lane < Lanes; lane++)
+            {
+                abef[lane] = _mm_add_epi32(abef[lane], abefSave[lane]);
+                cdgh[lane] = _mm_add_epi32(cdgh[lane], cdghSave[lane]);
+            }
+        }
+
+        for (std::size_t lane = 0; lane < Lanes; lane++)
+        {   // back to A..H
+            __m128i feba = _mm_shuffle_epi32(abef[lane], 0x1B);
+            __m128i dchg = _mm_shuffle_epi32(cdgh[lane], 0xB1);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(state[lane]), _mm_blend_epi16(feba, dchg, 0xF0));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(state[lane] + 4), _mm_alignr_epi8(dchg, feba, 8));
+        }
+    }
+
+    // Pads the bytes of the message after its last full block and runs them through the compression function.
+    static void ShaNiFinish(std::uint32_t* state, const SHA256::Buffer& buffer, std::vector<std::uint8_t>& hash)
+    {
+        std::size_t fullBlocks = buffer.second / 64;
+        std::size_t remainder = buffer.second % 64;
+        std::uint8_t tail[128] = { 0 };
+        if (remainder) { std::memcpy(tail, buffer.first + fullBlocks * 64, remainder); }
+        tail[remainder] = 0x80;
+        std::size_t tailBlocks = (remainder < 56) ? 1 : 2;
+        std::uint64_t bitLength = static_cast<std::uint64_t>(buffer.second) * 8;
+        for (std::size_t i = 0; i < 8; i++)
+        {
+            tail[tailBlocks * 64 - 1 - i] = static_cast<std::uint8_t>(bitLength >> (8 * i));
+        }
+        std::uint32_t* states[1] = { state };
+        const std::uint8_t* data[1] = { tail };
+        ShaNiCompress<1>(states, data, tailBlocks);
+
+        hash.resize(32);
+        for (std::size_t i = 0; i < 8; i++)
+        {
+            hash[i * 4]     = static_cast<std::uint8_t>(state[i] >> 24);
+            hash[i * 4 + 1] = static_cast<std::uint8_t>(state[i] >> 16);
+            hash[i * 4 + 2] = static_cast<std::uint8_t>(state[i] >> 8);
+            hash[i * 4 + 3] = static_cast<std::uint8_t>(state[i]);
+        }
+    }
+
+    static void ShaNiComputeHashes(const std::vector<SHA256::Buffer>& buffers, std::vector<std::vector<std::uint8_t>>& hashes)
+    {
+        std::size_t index = 0;
+        for (; index + 1 < buffers.size(); index += 2)
+        {
+            const auto& first = buffers[index];
+            const auto& second = buffers[index + 1];
+            std::uint32_t firstState[8], secondState[8];
+            std::memcpy(firstState, Sha256InitialState, sizeof(firstState));
+            std::memcpy(secondState, Sha256InitialState, sizeof(secondState));
+
+            // Interleave the full blocks both buffers have, then finish each on its own.
+            std::size_t firstBlocks = first.second / 64;
+            std::size_t secondBlocks = second.second / 64;
+            std::size_t common = std::min(firstBlocks, secondBlocks);
+            std::uint32_t* states[2] = { firstState, secondState };
+            const std::uint8_t* data[2] = { first.first, second.first };
+            ShaNiCompress<2>(states, data, common);
+
+            std::uint32_t* firstStates[1] = { firstState };
+            const std::uint8_t* firstData[1] = { first.first + common * 64 };
+            ShaNiCompress<1>(firstStates, firstData, firstBlocks - common);
+            std::uint32_t* secondStates[1] = { secondState };
+            const std::uint8_t* secondData[1] = { second.first + common * 64 };
+            ShaNiCompress<1>(secondStates, secondData, secondBlocks - common);
+
+            ShaNiFinish(firstState, first, hashes[index]);
+            ShaNiFinish(secondState, second, hashes[index + 1]);
+        }
+        if (index < buffers.size())
+        {
+            std::uint32_t state[8];
+            std::memcpy(state, Sha256InitialState, sizeof(state));
+            std::uint32_t* states[1] = { state };
+            const std::uint8_t* data[1] = { buffers[index].first };
+            ShaNiCompress<1>(states, data, buffers[index].second / 64);
+            ShaNiFinish(state, buffers[index], hashes[index]);
+        }
+    }
+#endif
+
+    void SHA256::ComputeHashes(const std::vector<Buffer>& buffers, std::vector<std::vector<std::uint8_t>>& hashes)
+    {
+        hashes.resize(buffers.size());
+        #ifdef MSIX_SHA256_SHANI
+        static const bool useShaNi = IsShaNiSupported();
+        if (useShaNi)
+        {
+            ShaNiComputeHashes(buffers, hashes);
+            return;
+        }
+        #endif
+        for (std::size_t i = 0; i < buffers.size(); i++)
+        {
+            ThrowErrorIfNot(Error::Unexpected,
+                ComputeHash(const_cast<std::uint8_t*>(buffers[i].first), buffers[i].second, hashes[i]),
+                "failed computing SHA256 hash");
+        }
+    }
+}
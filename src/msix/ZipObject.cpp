@@ -9,13 +9,22 @@
 #include "ZipObject.hpp"
 #include "ZipFileStream.hpp"
 #include "InflateStream.hpp"
+#include "ICompressionObject.hpp"
 #include "VectorStream.hpp"
+#include "RangeStream.hpp"
+#include "BufferPool.hpp"
 
 #include <memory>
 #include <string>
 #include <limits>
 #include <functional>
 #include <algorithm>
+#include <array>
+#include <cstring>
+
+#ifdef LINUX
+#include <fcntl.h>
+#endif
 namespace MSIX {
 /* Zip File Structure
 [LocalFileHeader 1]
@@ -162,19 +171,11 @@ class Zip64ExtendedInformation final : public Meta::StructuredObject<
 >
 {
 public:
-    void Read(const ComPtr<IStream>& stream)
+    void Read(const std::uint8_t* data)
     {
-        StreamBase::Read(stream, &Field<0>().value);
+        Decode(data);
         Meta::ExactValueValidation<std::uint32_t>(Field<0>().value, static_cast<std::uint32_t>(HeaderIDs::Zip64ExtendedInfo));
-
-        StreamBase::Read(stream, &Field<1>().value);
         Meta::OnlyEitherValueValidation<std::uint32_t>(Field<1>().value, 24, 28);
-        
-        StreamBase::Read(stream, &Field<2>().value);
-
-        StreamBase::Read(stream, &Field<3>().value);
-
-        StreamBase::Read(stream, &Field<4>().value);
         ThrowErrorIfNot(Error::ZipBadExtendedData, Field<4>().value < m_start.QuadPart, "invalid relative header offset");
     }
 
@@ -237,82 +238,54 @@ class CentralDirectoryFileHeader final : public Meta::StructuredObject<
     >
 {
 public:
-    void Read(const ComPtr<IStream>& stream)
+    // Decodes the header from a buffer holding the central directory. start is the absolute
+    // position of the header in the zip. Returns the number of bytes consumed.
+    std::size_t Read(const std::uint8_t* data, std::size_t size, std::uint64_t start)
     {
-        StreamBase::Read(stream, &Field<0>().value);
+        ThrowErrorIf(Error::ZipCentralDirectoryHeader, (size < FixedSize()), "central directory header truncated");
+        Decode(data);
         Meta::ExactValueValidation<std::uint32_t>(Field<0>().value, static_cast<std::uint32_t>(Signatures::CentralFileHeader));
 
-        StreamBase::Read(stream, &Field<1>().value);
-
-        StreamBase::Read(stream, &Field<2>().value);
-
-        StreamBase::Read(stream, &Field<3>().value);
         ThrowErrorIfNot(Error::ZipCentralDirectoryHeader,
             0 == (Field<3>().value & static_cast<std::uint16_t>(UnsupportedFlagsMask)),
             "unsupported flag(s) specified");
 
-        StreamBase::Read(stream, &Field<4>().value);
         Meta::OnlyEitherValueValidation<std::uint16_t>(Field<4>().value,  static_cast<std::uint16_t>(CompressionType::Deflate),
             static_cast<std::uint16_t>(CompressionType::Store));
 
-        StreamBase::Read(stream, &Field<5>().value);
-        StreamBase::Read(stream, &Field<6>().value);
-        StreamBase::Read(stream, &Field<7>().value);
-        StreamBase::Read(stream, &Field<8>().value);
-        StreamBase::Read(stream, &Field<9>().value);
-
-        StreamBase::Read(stream, &Field<10>().value);
         ThrowErrorIfNot(Error::ZipCentralDirectoryHeader, (Field<10>().value != 0), "unsupported file name size");
-        if (Field<10>().value !=0) {Field<17>().value.resize(Field<10>().value, 0); }
-
-        StreamBase::Read(stream, &Field<11>().value);
-        if (Field<11>().value != 0) { Field<18>().value.resize(Field<11>().value, 0); }
-
-        StreamBase::Read(stream, &Field<12>().value);
         Meta::ExactValueValidation<std::uint32_t>(Field<12>().value, 0);
-
-        StreamBase::Read(stream, &Field<13>().value);
         Meta::ExactValueValidation<std::uint32_t>(Field<13>().value, 0);
 
-        StreamBase::Read(stream, &Field<14>().value);
-
-        StreamBase::Read(stream, &Field<15>().value);
-        StreamBase::Read(stream, &Field<16>().value);
-        ULARGE_INTEGER pos = {0};
-        ThrowHrIfFailed(stream->Seek({0}, StreamBase::Reference::CURRENT, &pos));
+        std::uint64_t pos = start + OffsetOf(17);
         if (!GetIsZip64())
         {
-            ThrowErrorIf(Error::ZipCentralDirectoryHeader, (Field<16>().value >= pos.QuadPart), "invalid relative header offset");
+            ThrowErrorIf(Error::ZipCentralDirectoryHeader, (Field<16>().value >= pos), "invalid relative header offset");
         }
         else
         {
             ThrowErrorIf(Error::ZipCentralDirectoryHeader, (Field<16>().value != 0xFFFFFFFF), "invalid zip64 local header offset");
         }
 
-        if (Field<17>().Size())
-        {
-            ThrowHrIfFailed(stream->Read(reinterpret_cast<void*>(Field<17>().value.data()), static_cast<ULONG>(Field<17>().Size()), nullptr));
-        }
+        std::size_t consumed = FixedSize();
+        ThrowErrorIf(Error::ZipCentralDirectoryHeader, (size - consumed < static_cast<std::size_t>(Field<10>().value) + Field<11>().value),
+            "central directory header truncated");
+        Field<17>().value.assign(data + consumed, data + consumed + Field<10>().value);
+        consumed += Field<10>().value;
+        Field<18>().value.assign(data + consumed, data + consumed + Field<11>().value);
+        consumed += Field<11>().value;
 
-        if (Field<18>().Size())
-        {
-            ThrowHrIfFailed(stream->Read(reinterpret_cast<void*>(Field<18>().value.data()), static_cast<ULONG>(Field<18>().Size()), nullptr));
-        }
         // Only process for Zip64ExtendedInformation
         if (Field<18>().Size() > 2 && Field<18>().value[0] == 0x01 && Field<18>().value[1] == 0x00)
         {
-            LARGE_INTEGER zero = {0};
-            ThrowHrIfFailed(stream->Seek(zero, StreamBase::Reference::CURRENT, &pos));
-            auto vectorStream = ComPtr<IStream>::Make<VectorStream>(&Field<18>().value);
-            m_extendedInfo = std::make_unique<Zip64ExtendedInformation>(pos);
+            ULARGE_INTEGER extendedInfoEnd = {0};
+            extendedInfoEnd.QuadPart = start + consumed;
+            m_extendedInfo = std::make_unique<Zip64ExtendedInformation>(extendedInfoEnd);
             ThrowErrorIfNot(Error::ZipCentralDirectoryHeader, (Field<18>().Size() >= m_extendedInfo->Size()), "Unexpected extended info size");
-            m_extendedInfo->Read(vectorStream.Get());
-        }
-
-        if (Field<19>().Size())
-        {
-            ThrowHrIfFailed(stream->Read(reinterpret_cast<void*>(Field<19>().value.data()), static_cast<ULONG>(Field<19>().Size()), nullptr));
+            m_extendedInfo->Read(Field<18>().value.data());
         }
+        // file comment length is validated to be 0 above, so Field<19> is always empty.
+        return consumed;
     }
 
     CentralDirectoryFileHeader(bool isZip64) : m_isZip64(isZip64)
@@ -430,51 +403,35 @@ class LocalFileHeader final : public Meta::StructuredObject<
 public:
     void Read(const ComPtr<IStream> &stream)
     {
-        StreamBase::Read(stream, &Field<0>().value);
-        Meta::ExactValueValidation<std::uint32_t>( Field<0>().value, static_cast<std::uint32_t>(Signatures::LocalFileHeader));
-
-        StreamBase::Read(stream, &Field<1>().value);
-        Meta::OnlyEitherValueValidation<std::uint16_t>(Field<1>().value, static_cast<std::uint16_t>(ZipVersions::Zip32DefaultVersion),
-                                                  static_cast<std::uint16_t>(ZipVersions::Zip64FormatExtension));
-
-        StreamBase::Read(stream, &Field<2>().value);
-        ThrowErrorIfNot(Error::ZipLocalFileHeader, ((Field<2>().value & static_cast<std::uint16_t>(UnsupportedFlagsMask)) == 0), "unsupported flag(s) specified");
-        ThrowErrorIfNot(Error::ZipLocalFileHeader, (IsGeneralPurposeBitSet() == m_directoryEntry->IsGeneralPurposeBitSet()), "inconsistent general purpose bits specified");
-
-        StreamBase::Read(stream, &Field<3>().value);
-        Meta::OnlyEitherValueValidation<std::uint16_t>(Field<3>().value, static_cast<std::uint16_t>(CompressionType::Deflate),
-                                                  static_cast<std::uint16_t>(CompressionType::Store));
-
-        StreamBase::Read(stream, &Field<4>().value);
-        StreamBase::Read(stream, &Field<5>().value);
-        StreamBase::Read(stream, &Field<6>().value);
-        ThrowErrorIfNot(Error::ZipLocalFileHeader, (!IsGeneralPurposeBitSet() || (Field<6>().value == 0)), "Invalid Zip CRC");
+        std::array<std::uint8_t, FixedSize()> header;
+        StreamBase::Read(stream, &header);
+        Decode(header.data());
+        ValidateFixedFields();
+        ThrowErrorIfNot(Error::ZipLocalFileHeader, (IsGeneralPurposeBitSet() == m_directoryEntry.isGeneralPurposeBitSet), "inconsistent general purpose bits specified");
 
-        StreamBase::Read(stream, &Field<7>().value);
-        ThrowErrorIfNot(Error::ZipLocalFileHeader, (!IsGeneralPurposeBitSet() || (Field<7>().value == 0)), "Invalid Zip compressed size");
-
-        StreamBase::Read(stream, &Field<8>().value);
-
-        StreamBase::Read(stream, &Field<9>().value);
-        ThrowErrorIfNot(Error::ZipLocalFileHeader, (Field<9>().value != 0), "unsupported file name size");
-        Field<11>().value.resize(GetFileNameLength(), 0);
-
-        StreamBase::Read(stream, &Field<10>().value);
         // Even if we don't validate them, we need to read the extra field
-        if (Field<10>().value != 0) {Field<12>().value.resize(Field<10>().value, 0); }
-
-        if (Field<11>().Size())
-        {
-            ThrowHrIfFailed(stream->Read(reinterpret_cast<void*>(Field<11>().value.data()), static_cast<ULONG>(Field<11>().Size()), nullptr));
-        }
+        std::vector<std::uint8_t> variableFields(static_cast<std::size_t>(GetFileNameLength()) + GetExtraFieldLength());
+        StreamBase::Read(stream, variableFields);
+        Field<11>().value.assign(variableFields.begin(), variableFields.begin() + GetFileNameLength());
+        Field<12>().value.assign(variableFields.begin() + GetFileNameLength(), variableFields.end());
+    }
 
-        if (Field<12>().Size())
-        {
-            ThrowHrIfFailed(stream->Read(reinterpret_cast<void*>(Field<12>().value.data()), static_cast<ULONG>(Field<12>().Size()), nullptr));
-        }
+    // Decodes the header from the start of a buffer of size bytes when the zip is read front to back, before
+    // there is a central directory entry to check it against. Returns the number of bytes consumed.
+    std::size_t Read(const std::uint8_t* data, std::size_t size)
+    {
+        ThrowErrorIf(Error::ZipLocalFileHeader, (size < FixedSize()), "local file header truncated");
+        Decode(data);
+        ValidateFixedFields();
+
+        std::size_t variableSize = static_cast<std::size_t>(GetFileNameLength()) + GetExtraFieldLength();
+        ThrowErrorIf(Error::ZipLocalFileHeader, (size - FixedSize() < variableSize), "local file header truncated");
+        Field<11>().value.assign(data + FixedSize(), data + FixedSize() + GetFileNameLength());
+        Field<12>().value.assign(data + FixedSize() + GetFileNameLength(), data + FixedSize() + variableSize);
+        return FixedSize() + variableSize;
     }
 
-    LocalFileHeader(std::shared_ptr<CentralDirectoryFileHeader> directoryEntry) : m_isZip64(directoryEntry->GetIsZip64()), m_directoryEntry(directoryEntry)
+    LocalFileHeader(const ZipCentralDirectoryEntry& directoryEntry) : m_directoryEntry(directoryEntry)
     {
     }
 
@@ -488,11 +445,27 @@ public:
 
     std::uint64_t GetCompressedSize() noexcept
     {
-        return IsGeneralPurposeBitSet() ? m_directoryEntry->GetCompressedSize() : static_cast<std::uint64_t>(Field<7>().value);
+        return IsGeneralPurposeBitSet() ? m_directoryEntry.compressedSize : static_cast<std::uint64_t>(Field<7>().value);
     }
 
     std::uint64_t GetUncompressedSize() noexcept
-    {   return IsGeneralPurposeBitSet() ? m_directoryEntry->GetUncompressedSize() : static_cast<std::uint64_t>(Field<8>().value);
+    {   return IsGeneralPurposeBitSet() ? m_directoryEntry.uncompressedSize : static_cast<std::uint64_t>(Field<8>().value);
+    }
+
+    // The sizes recorded in the header itself, for when there is no central directory entry yet. Only meaningful
+    // if the general purpose bit isn't set. Sizes that don't fit in 32 bits are in the zip64 extended information
+    // extra field, which holds the uncompressed size first and then the compressed size, but only those of them
+    // that didn't fit.
+    std::uint64_t GetLocalUncompressedSize()
+    {
+        if (Field<8>().value != std::numeric_limits<std::uint32_t>::max()) { return Field<8>().value; }
+        return GetZip64ExtendedInformationField(0);
+    }
+
+    std::uint64_t GetLocalCompressedSize()
+    {
+        if (Field<7>().value != std::numeric_limits<std::uint32_t>::max()) { return Field<7>().value; }
+        return GetZip64ExtendedInformationField((Field<8>().value == std::numeric_limits<std::uint32_t>::max()) ? 1 : 0);
     }
 
     std::uint16_t GetFileNameLength()                  noexcept { return Field<9>().value;  }
@@ -517,8 +490,44 @@ public:
         SetFileNameLength(static_cast<std::uint16_t>(name.size()));
     }
 protected:
-    bool                                        m_isZip64        = false;
-    std::shared_ptr<CentralDirectoryFileHeader> m_directoryEntry = nullptr;
+    void ValidateFixedFields()
+    {
+        Meta::ExactValueValidation<std::uint32_t>( Field<0>().value, static_cast<std::uint32_t>(Signatures::LocalFileHeader));
+
+        Meta::OnlyEitherValueValidation<std::uint16_t>(Field<1>().value, static_cast<std::uint16_t>(ZipVersions::Zip32DefaultVersion),
+                                                  static_cast<std::uint16_t>(ZipVersions::Zip64FormatExtension));
+
+        ThrowErrorIfNot(Error::ZipLocalFileHeader, ((Field<2>().value & static_cast<std::uint16_t>(UnsupportedFlagsMask)) == 0), "unsupported flag(s) specified");
+
+        Meta::OnlyEitherValueValidation<std::uint16_t>(Field<3>().value, static_cast<std::uint16_t>(CompressionType::Deflate),
+                                                  static_cast<std::uint16_t>(CompressionType::Store));
+
+        ThrowErrorIfNot(Error::ZipLocalFileHeader, (!IsGeneralPurposeBitSet() || (Field<6>().value == 0)), "Invalid Zip CRC");
+        ThrowErrorIfNot(Error::ZipLocalFileHeader, (!IsGeneralPurposeBitSet() || (Field<7>().value == 0)), "Invalid Zip compressed size");
+        ThrowErrorIfNot(Error::ZipLocalFileHeader, (Field<9>().value != 0), "unsupported file name size");
+    }
+
+    // Returns the index'th 8 byte value of the zip64 extended information extra field.
+    std::uint64_t GetZip64ExtendedInformationField(std::size_t index)
+    {
+        const auto& extra = Field<12>().value;
+        std::size_t offset = 0;
+        while (extra.size() - offset >= 4)
+        {
+            auto id = Meta::LoadLittleEndian<std::uint16_t>(extra.data() + offset);
+            std::size_t size = Meta::LoadLittleEndian<std::uint16_t>(extra.data() + offset + 2);
+            ThrowErrorIf(Error::ZipLocalFileHeader, (extra.size() - offset - 4 < size), "invalid extra field");
+            if (id == static_cast<std::uint16_t>(HeaderIDs::Zip64ExtendedInfo))
+            {
+                ThrowErrorIf(Error::ZipBadExtendedData, (size < (index + 1) * 8), "Unexpected extended info size");
+                return Meta::LoadLittleEndian<std::uint64_t>(extra.data() + offset + 4 + index * 8);
+            }
+            offset += 4 + size;
+        }
+        ThrowErrorAndLog(Error::ZipLocalFileHeader, "missing zip64 extended information");
+    }
+
+    ZipCentralDirectoryEntry m_directoryEntry;
 }; //class LocalFileHeader
 
 //////////////////////////////////////////////////////////////////////////////////////////////
@@ -542,47 +551,31 @@ class Zip64EndOfCentralDirectoryRecord final : public Meta::StructuredObject<
 public:
     void Read(const ComPtr<IStream>& stream)
     {
-        StreamBase::Read(stream, &Field<0>().value);
+        ULARGE_INTEGER start = {0};
+        ThrowHrIfFailed(stream->Seek({0}, StreamBase::Reference::CURRENT, &start));
+        std::array<std::uint8_t, FixedSize()> record;
+        StreamBase::Read(stream, &record);
+        Decode(record.data());
         Meta::ExactValueValidation<std::uint32_t>(Field<0>().value, static_cast<std::uint32_t>(Signatures::Zip64EndOfCD));
 
-        StreamBase::Read(stream, &Field<1>().value);
         //4.3.14.1 The value stored into the "size of zip64 end of central
         //    directory record" should be the size of the remaining
         //    record and should not include the leading 12 bytes.
         ThrowErrorIfNot(Error::Zip64EOCDRecord, (Field<1>().value == (this->Size() - 12)), "invalid size of zip64 EOCD");
 
-        StreamBase::Read(stream, &Field<2>().value);
         Meta::ExactValueValidation<std::uint16_t>(Field<2>().value, static_cast<std::uint16_t>(ZipVersions::Zip64FormatExtension));
-
-        StreamBase::Read(stream, &Field<3>().value);
         Meta::ExactValueValidation<std::uint16_t>(Field<3>().value, static_cast<std::uint16_t>(ZipVersions::Zip64FormatExtension));
-
-        StreamBase::Read(stream, &Field<4>().value);
         Meta::ExactValueValidation<std::uint32_t>(Field<4>().value, 0);
-
-        StreamBase::Read(stream, &Field<5>().value);
         Meta::ExactValueValidation<std::uint32_t>(Field<5>().value, 0);
-
-        StreamBase::Read(stream, &Field<6>().value);
         Meta::NotValueValidation<std::uint64_t>(Field<6>().value, 0);
-
-        StreamBase::Read(stream, &Field<7>().value);
         Meta::NotValueValidation<std::uint64_t>(Field<7>().value, 0);
         ThrowErrorIfNot(Error::Zip64EOCDRecord, (Field<7>().value == this->GetTotalNumberOfEntries()), "invalid total number of entries");
 
-        ULARGE_INTEGER pos = {0};
-        ThrowHrIfFailed(stream->Seek({0}, StreamBase::Reference::CURRENT, &pos));
-        StreamBase::Read(stream, &Field<8>().value);
-        ThrowErrorIfNot(Error::Zip64EOCDRecord, ((Field<8>().value != 0) && (Field<8>().value < pos.QuadPart)), "invalid size of central directory");
-
-        ThrowHrIfFailed(stream->Seek({0}, StreamBase::Reference::CURRENT, &pos));
-        StreamBase::Read(stream, &Field<9>().value);
-        ThrowErrorIfNot(Error::Zip64EOCDRecord, ((Field<9>().value != 0) && (Field<9>().value < pos.QuadPart)), "invalid size of central directory");
+        std::uint64_t pos = start.QuadPart + OffsetOf(8);
+        ThrowErrorIfNot(Error::Zip64EOCDRecord, ((Field<8>().value != 0) && (Field<8>().value < pos)), "invalid size of central directory");
 
-        if (Field<10>().Size())
-        {
-            ThrowHrIfFailed(stream->Read(reinterpret_cast<void*>(Field<10>().value.data()), static_cast<ULONG>(Field<10>().Size()), nullptr));
-        }
+        pos = start.QuadPart + OffsetOf(9);
+        ThrowErrorIfNot(Error::Zip64EOCDRecord, ((Field<9>().value != 0) && (Field<9>().value < pos)), "invalid size of central directory");
     }
 
     Zip64EndOfCentralDirectoryRecord()
@@ -632,18 +625,16 @@ class Zip64EndOfCentralDirectoryLocator final : public Meta::StructuredObject<
 public:
     void Read(const ComPtr<IStream>& stream)
     {
-        StreamBase::Read(stream, &Field<0>().value);
+        ULARGE_INTEGER start = {0};
+        ThrowHrIfFailed(stream->Seek({0}, StreamBase::Reference::CURRENT, &start));
+        std::array<std::uint8_t, FixedSize()> locator;
+        StreamBase::Read(stream, &locator);
+        Decode(locator.data());
         Meta::ExactValueValidation<std::uint32_t>(Field<0>().value, static_cast<std::uint32_t>(Signatures::Zip64EndOfCDLocator));
-
-        StreamBase::Read(stream, &Field<1>().value);
         Meta::ExactValueValidation<std::uint32_t>(Field<1>().value, 0);
 
-        ULARGE_INTEGER pos = {0};
-        StreamBase::Read(stream, &Field<2>().value);
-        ThrowHrIfFailed(stream->Seek({0}, StreamBase::Reference::CURRENT, &pos));
-        ThrowErrorIfNot(Error::Zip64EOCDLocator, ((Field<2>().value != 0) && (Field<2>().value < pos.QuadPart)), "Invalid relative offset");
-
-        StreamBase::Read(stream, &Field<3>().value);
+        std::uint64_t pos = start.QuadPart + OffsetOf(3);
+        ThrowErrorIfNot(Error::Zip64EOCDLocator, ((Field<2>().value != 0) && (Field<2>().value < pos)), "Invalid relative offset");
         Meta::ExactValueValidation<std::uint32_t>(Field<3>().value, 1);
     }
 
@@ -686,28 +677,21 @@ class EndCentralDirectoryRecord final : public Meta::StructuredObject<
 public:
     void Read(const ComPtr<IStream>& stream)
     {
-        StreamBase::Read(stream, &Field<0>().value);
+        std::array<std::uint8_t, FixedSize()> record;
+        StreamBase::Read(stream, &record);
+        Decode(record.data());
         Meta::ExactValueValidation<std::uint32_t>(Field<0>().value, static_cast<std::uint32_t>(Signatures::EndOfCentralDirectory));
 
-        StreamBase::Read(stream, &Field<1>().value);
         Meta::OnlyEitherValueValidation<std::uint32_t>(Field<1>().value, 0, 0xFFFF);
-
-        StreamBase::Read(stream, &Field<2>().value);
         Meta::OnlyEitherValueValidation<std::uint32_t>(Field<2>().value, 0, 0xFFFF);
         ThrowErrorIf(Error::ZipEOCDRecord, (Field<1>().value != Field<2>().value), "field missmatch");
         m_isZip64 = (0xFFFF == Field<2>().value);
 
-        StreamBase::Read(stream, &Field<3>().value);
         if (Field<3>().value != 0 && Field<3>().value != 0xFFFF)
         {   m_archiveHasZip64Locator = false;
         }
-
-        StreamBase::Read(stream, &Field<4>().value);
         ThrowErrorIf(Error::ZipEOCDRecord, (Field<3>().value != Field<4>().value), "field missmatch");
 
-        StreamBase::Read(stream, &Field<5>().value);
-        StreamBase::Read(stream, &Field<6>().value);
-
         if(m_archiveHasZip64Locator)
         {
             ThrowErrorIf(Error::ZipEOCDRecord, ((Field<5>().value != 0) && (Field<5>().value != 0xFFFFFFFF)),
@@ -716,13 +700,7 @@ public:
                 "unsupported offset of start of central directory");
         }
 
-        StreamBase::Read(stream, &Field<7>().value);
         Meta::ExactValueValidation<std::uint32_t>(Field<7>().value, 0);
-
-        if (Field<8>().Size())
-        {
-           ThrowHrIfFailed(stream->Read(reinterpret_cast<void*>(Field<8>().value.data()), static_cast<ULONG>(Field<8>().Size()), nullptr));
-        }
     }
 
     EndCentralDirectoryRecord()
@@ -759,27 +737,406 @@ private:
     void SetCommentLength(std::uint16_t value)                  noexcept { Field<7>().value = value; }
 };//class EndCentralDirectoryRecord
 
+//////////////////////////////////////////////////////////////////////////////////////////////
+//                                  Forward only reading                                    //
+//////////////////////////////////////////////////////////////////////////////////////////////
+// The largest data descriptor: signature, crc-32 and 8 byte compressed and uncompressed sizes.
+static const std::size_t MaxDataDescriptorSize = 24;
+
+static bool IsHeaderSignature(std::uint32_t signature)
+{
+    return (signature == static_cast<std::uint32_t>(Signatures::LocalFileHeader)) ||
+           (signature == static_cast<std::uint32_t>(Signatures::CentralFileHeader));
+}
+
+// Returns the size of the data descriptor at the start of data if it records the given sizes, 0 otherwise.
+// Its signature is optional and its sizes are 4 or 8 bytes, so it is only taken for one if it is followed
+// by the next header or by the end of the zip, which is the case when available is exactly its size.
+static std::size_t MatchDataDescriptor(const std::uint8_t* data, std::size_t available, std::uint64_t compressedSize, std::uint64_t uncompressedSize)
+{
+    std::size_t start = ((available >= 4) && (Meta::LoadLittleEndian<std::uint32_t>(data) == static_cast<std::uint32_t>(Signatures::DataDescriptor))) ? 4 : 0;
+    for (std::size_t sizeOfSize : { 8, 4 })
+    {
+        std::size_t size = start + 4 + 2 * sizeOfSize;
+        if (available < size) { continue; }
+        const std::uint8_t* sizes = data + start + 4;
+        std::uint64_t compressed   = (sizeOfSize == 8) ? Meta::LoadLittleEndian<std::uint64_t>(sizes) : Meta::LoadLittleEndian<std::uint32_t>(sizes);
+        std::uint64_t uncompressed = (sizeOfSize == 8) ? Meta::LoadLittleEndian<std::uint64_t>(sizes + 8) : Meta::LoadLittleEndian<std::uint32_t>(sizes + 4);
+        bool isFollowedByHeader = (available == size) || ((available - size >= 4) && IsHeaderSignature(Meta::LoadLittleEndian<std::uint32_t>(data + size)));
+        if ((compressed == compressedSize) && (uncompressed == uncompressedSize) && isFollowedByHeader)
+        {   return size;
+        }
+    }
+    return 0;
+}
+
+// Reads a stream that can't seek front to back through a buffer. The zip structures are decoded from the
+// buffer before they are consumed, which is also how the end of a file that is only given by the data
+// descriptor after it is found. Seeking is limited to asking for the current position.
+class ForwardOnlyStream final : public StreamBase
+{
+public:
+    static const std::size_t BufferSize = 256 * 1024;
+
+    ForwardOnlyStream(const ComPtr<IStream>& stream) : m_stream(stream), m_buffer(BufferSize) {}
+
+    // Makes at least size bytes available at Data(), unless the stream ends first. Returns the number of
+    // bytes available, which can be more than size. size can't be more than BufferSize.
+    std::size_t Fill(std::size_t size)
+    {
+        while (((m_end - m_begin) < size) && !m_atEnd)
+        {
+            if (m_end == m_buffer.size())
+            {   // Move what is left to the front to make room.
+                std::memmove(m_buffer.data(), m_buffer.data() + m_begin, m_end - m_begin);
+                m_end -= m_begin;
+                m_begin = 0;
+            }
+            ULONG bytesRead = 0;
+            ThrowHrIfFailed(m_stream->Read(m_buffer.data() + m_end, static_cast<ULONG>(m_buffer.size() - m_end), &bytesRead));
+            m_atEnd = (bytesRead == 0);
+            m_end += bytesRead;
+        }
+        return m_end - m_begin;
+    }
+
+    const std::uint8_t* Data() { return m_buffer.data() + m_begin; }
+
+    void Consume(std::size_t size)
+    {
+        m_begin += size;
+        m_position += size;
+    }
+
+    std::uint64_t Position() { return m_position; }
+
+    // IStream
+    HRESULT STDMETHODCALLTYPE Read(void* buffer, ULONG countBytes, ULONG* bytesRead) noexcept override try
+    {
+        ULONG amountRead = 0;
+        while (amountRead < countBytes)
+        {
+            std::size_t available = Fill(std::min(static_cast<std::size_t>(countBytes - amountRead), BufferSize));
+            if (available == 0) { break; }
+            auto amountToCopy = static_cast<ULONG>(std::min(available, static_cast<std::size_t>(countBytes - amountRead)));
+            std::memcpy(static_cast<std::uint8_t*>(buffer) + amountRead, Data(), amountToCopy);
+            Consume(amountToCopy);
+            amountRead += amountToCopy;
+        }
+        if (bytesRead) { *bytesRead = amountRead; }
+        return static_cast<HRESULT>(Error::OK);
+    } CATCH_RETURN();
+
+    HRESULT STDMETHODCALLTYPE Seek(LARGE_INTEGER move, DWORD origin, ULARGE_INTEGER* newPosition) noexcept override try
+    {
+        ThrowErrorIfNot(Error::FileSeek, ((origin == Reference::CURRENT) && (move.QuadPart == 0)), "stream can only be read front to back");
+        if (newPosition) { newPosition->QuadPart = m_position; }
+        return static_cast<HRESULT>(Error::OK);
+    } CATCH_RETURN();
+
+protected:
+    ComPtr<IStream>           m_stream;
+    std::vector<std::uint8_t> m_buffer;
+    std::size_t               m_begin = 0;
+    std::size_t               m_end = 0;
+    std::uint64_t             m_position = 0;
+    bool                      m_atEnd = false;
+};
+
+// The uncompressed contents of the file whose data is at the front of a ForwardOnlyStream. It can only be
+// read until Finish, which skips what wasn't read of the file along with its data descriptor and checks the
+// sizes.
+class ForwardOnlyFileStream final : public StreamBase
+{
+public:
+    ForwardOnlyFileStream(ForwardOnlyStream* source, ICompressionObject* inflater, LocalFileHeader& header) :
+        m_source(source),
+        m_inflater(inflater),
+        m_isCompressed(header.GetCompressionType() == CompressionType::Deflate),
+        m_hasDataDescriptor(header.IsGeneralPurposeBitSet())
+    {
+        if (!m_hasDataDescriptor)
+        {
+            m_compressedSize = header.GetLocalCompressedSize();
+            m_uncompressedSize = header.GetLocalUncompressedSize();
+            ThrowErrorIf(Error::ZipLocalFileHeader, (!m_isCompressed && (m_compressedSize != m_uncompressedSize)), "invalid size of stored file");
+        }
+        if (m_isCompressed)
+        {
+            ThrowErrorIf(Error::InflateInitialize, (m_inflater->Initialize(CompressionOperation::Inflate) != CompressionStatus::Ok),
+                "Initialization of inflate failed");
+            m_isInflating = true;
+        }
+    }
+
+    ~ForwardOnlyFileStream()
+    {
+        if (m_isInflating) { m_inflater->Cleanup(); }
+    }
+
+    // Copies the file's data into raw as it is on the zip as it is read. Only possible before any of it is read.
+    void Keep(std::vector<std::uint8_t>* raw)
+    {
+        ThrowErrorIf(Error::Unexpected, (m_compressedRead != 0), "file was already read");
+        m_raw = raw;
+    }
+
+    void Finish()
+    {
+        auto scratch = BufferPool::Get(64 * 1024);
+        while (!m_atEnd)
+        {   ReadSome(scratch->data(), scratch->size());
+        }
+        if (m_isInflating)
+        {
+            m_inflater->Cleanup();
+            m_isInflating = false;
+        }
+
+        if (m_hasDataDescriptor)
+        {
+            std::size_t available = m_source->Fill(MaxDataDescriptorSize + 4);
+            std::size_t size = MatchDataDescriptor(m_source->Data(), available, m_compressedRead, m_uncompressedRead);
+            ThrowErrorIf(Error::ZipLocalFileHeader, (size == 0), "data descriptor doesn't match the file");
+            m_source->Consume(size);
+            m_compressedSize = m_compressedRead;
+            m_uncompressedSize = m_uncompressedRead;
+        }
+        ThrowErrorIf(Error::ZipLocalFileHeader, ((m_compressedRead != m_compressedSize) || (m_uncompressedRead != m_uncompressedSize)),
+            "size of file doesn't match local file header");
+        m_source = nullptr;
+    }
+
+    std::uint64_t GetCompressedSize()   { return m_compressedSize; }
+    std::uint64_t GetUncompressedSize() { return m_uncompressedSize; }
+
+    // IStream
+    HRESULT STDMETHODCALLTYPE Read(void* buffer, ULONG countBytes, ULONG* bytesRead) noexcept override try
+    {
+        ThrowErrorIf(Error::FileRead, (m_source == nullptr), "file can only be read while the zip is read front to back");
+        ULONG amountRead = 0;
+        while ((amountRead < countBytes) && !m_atEnd)
+        {   amountRead += static_cast<ULONG>(ReadSome(static_cast<std::uint8_t*>(buffer) + amountRead, countBytes - amountRead));
+        }
+        if (bytesRead) { *bytesRead = amountRead; }
+        return static_cast<HRESULT>(Error::OK);
+    } CATCH_RETURN();
+
+    HRESULT STDMETHODCALLTYPE Seek(LARGE_INTEGER move, DWORD origin, ULARGE_INTEGER* newPosition) noexcept override try
+    {
+        ThrowErrorIfNot(Error::FileSeek, ((origin == Reference::CURRENT) && (move.QuadPart == 0)), "stream can only be read front to back");
+        if (newPosition) { newPosition->QuadPart = m_uncompressedRead; }
+        return static_cast<HRESULT>(Error::OK);
+    } CATCH_RETURN();
+
+protected:
+    std::size_t ReadSome(std::uint8_t* buffer, std::size_t size)
+    {
+        return m_isCompressed ? ReadCompressed(buffer, size) : ReadStored(buffer, size);
+    }
+
+    std::size_t ReadStored(std::uint8_t* buffer, std::size_t size)
+    {
+        std::size_t fileBytes = 0;
+        if (!m_hasDataDescriptor)
+        {
+            std::uint64_t remaining = m_compressedSize - m_compressedRead;
+            if (remaining == 0)
+            {
+                m_atEnd = true;
+                return 0;
+            }
+            fileBytes = m_source->Fill(static_cast<std::size_t>(std::min(remaining, static_cast<std::uint64_t>(ForwardOnlyStream::BufferSize))));
+            ThrowErrorIf(Error::FileRead, (fileBytes == 0), "zip is truncated");
+            fileBytes = static_cast<std::size_t>(std::min(static_cast<std::uint64_t>(fileBytes), remaining));
+        }
+        else
+        {
+            if ((m_knownFileBytes == 0) && !m_isDataDescriptorFound) { FindDataDescriptor(); }
+            fileBytes = m_knownFileBytes;
+        }
+        std::size_t amountToCopy = std::min(size, fileBytes);
+        std::memcpy(buffer, m_source->Data(), amountToCopy);
+        Consume(amountToCopy);
+        m_uncompressedRead += amountToCopy;
+        if (m_hasDataDescriptor)
+        {
+            m_knownFileBytes -= amountToCopy;
+            m_atEnd = (m_knownFileBytes == 0) && m_isDataDescriptorFound;
+        }
+        return amountToCopy;
+    }
+
+    // The file ends where a data descriptor that matches what was read so far begins. Scans the buffered
+    // bytes for it, holding back those that could be the start of one until there is enough after them to tell.
+    void FindDataDescriptor()
+    {
+        std::size_t available = m_source->Fill(ForwardOnlyStream::BufferSize);
+        bool isAtEndOfZip = (available < ForwardOnlyStream::BufferSize);
+        const std::uint8_t* data = m_source->Data();
+        std::size_t offset = 0;
+        for (; offset + 4 <= available; offset++)
+        {
+            if (Meta::LoadLittleEndian<std::uint32_t>(data + offset) != static_cast<std::uint32_t>(Signatures::DataDescriptor)) { continue; }
+            if (!isAtEndOfZip && (available - offset < MaxDataDescriptorSize + 4)) { break; }
+            if (MatchDataDescriptor(data + offset, available - offset, m_compressedRead + offset, m_uncompressedRead + offset) != 0)
+            {
+                m_isDataDescriptorFound = true;
+                break;
+            }
+        }
+        ThrowErrorIf(Error::ZipLocalFileHeader, (!m_isDataDescriptorFound && isAtEndOfZip), "data descriptor not found");
+        m_knownFileBytes = offset;
+    }
+
+    std::size_t ReadCompressed(std::uint8_t* buffer, std::size_t size)
+    {
+        std::size_t available = m_source->Fill(1);
+        if (!m_hasDataDescriptor)
+        {   available = static_cast<std::size_t>(std::min(static_cast<std::uint64_t>(available), m_compressedSize - m_compressedRead));
+        }
+        m_inflater->SetInput(const_cast<std::uint8_t*>(m_source->Data()), available);
+        m_inflater->SetOutput(buffer, size);
+        auto status = m_inflater->Inflate();
+        ThrowErrorIf(Error::InflateCorruptData, ((status == CompressionStatus::Error) || (status == CompressionStatus::NeedDictionary)),
+            "inflate failed unexpectedly.");
+        std::size_t consumed = available - m_inflater->GetAvailableSourceSize();
+        std::size_t produced = size - m_inflater->GetAvailableDestinationSize();
+        Consume(consumed);
+        m_uncompressedRead += produced;
+        if (status == CompressionStatus::End)
+        {   m_atEnd = true;
+        }
+        else
+        {   ThrowErrorIf(Error::InflateCorruptData, ((consumed == 0) && (produced == 0)), "zip is truncated");
+        }
+        return produced;
+    }
+
+    void Consume(std::size_t size)
+    {
+        if (m_raw) { m_raw->insert(m_raw->end(), m_source->Data(), m_source->Data() + size); }
+        m_source->Consume(size);
+        m_compressedRead += size;
+    }
+
+    ForwardOnlyStream*         m_source;
+    ICompressionObject*        m_inflater;
+    std::vector<std::uint8_t>* m_raw = nullptr;
+    bool                       m_isCompressed;
+    bool                       m_hasDataDescriptor;
+    bool                       m_isInflating = false;
+    bool                       m_atEnd = false;
+    // Of a stored file with a data descriptor, the bytes ahead that are known to be part of it.
+    std::size_t                m_knownFileBytes = 0;
+    bool                       m_isDataDescriptorFound = false;
+    std::uint64_t              m_compressedSize = 0;
+    std::uint64_t              m_uncompressedSize = 0;
+    std::uint64_t              m_compressedRead = 0;
+    std::uint64_t              m_uncompressedRead = 0;
+};
+
+// Decodes the central directory, read whole into centralDirectory, into compact records. start is the
+// position of the central directory in the zip. fileNames gets the names in the order of their local file
+// headers, so reading the files in this order reads the zip front to back.
+static void DecodeCentralDirectory(const std::vector<std::uint8_t>& centralDirectory, std::uint64_t start, std::uint64_t totalNumberOfEntries,
+    EndCentralDirectoryRecord& endCentralDirectoryRecord, std::map<std::string, ZipCentralDirectoryEntry>& entries,
+    std::vector<std::string>& fileNames)
+{
+    std::vector<std::pair<std::uint64_t, std::string>> orderedNames;
+    std::size_t offset = 0;
+    for (std::uint64_t index = 0; index < totalNumberOfEntries; index++)
+    {
+        CentralDirectoryFileHeader centralFileHeader(endCentralDirectoryRecord.GetIsZip64());
+        offset += centralFileHeader.Read(centralDirectory.data() + offset, centralDirectory.size() - offset, start + offset);
+        ZipCentralDirectoryEntry entry;
+        entry.localHeaderOffset      = centralFileHeader.GetRelativeOffsetOfLocalHeader();
+        entry.compressedSize         = centralFileHeader.GetCompressedSize();
+        entry.uncompressedSize       = centralFileHeader.GetUncompressedSize();
+        entry.isGeneralPurposeBitSet = centralFileHeader.IsGeneralPurposeBitSet();
+        // TODO: ensure that there are no collisions on name!
+        auto inserted = entries.insert(std::make_pair(centralFileHeader.GetFileName(), entry));
+        if (inserted.second) { orderedNames.push_back(std::make_pair(entry.localHeaderOffset, inserted.first->first)); }
+    }
+
+    std::sort(orderedNames.begin(), orderedNames.end());
+    fileNames.clear();
+    fileNames.reserve(orderedNames.size());
+    for (auto& name : orderedNames) { fileNames.push_back(std::move(name.second)); }
+
+    if (endCentralDirectoryRecord.GetArchiveHasZip64Locator())
+    {   // We should have no data between the end of the last central directory header and the start of the EoCD
+        ThrowErrorIfNot(Error::ZipHiddenData, (offset == centralDirectory.size()), "hidden data unsupported");
+    }
+}
+
 //////////////////////////////////////////////////////////////////////////////////////////////
 //                              ZipObject member implementation                             //
 //////////////////////////////////////////////////////////////////////////////////////////////
 std::vector<std::string> ZipObject::GetFileNames(FileNameOptions)
+{   // In the order of their local file headers, see DecodeCentralDirectory.
+    return m_fileNames;
+}
+
+void ZipObject::WillRead(const std::string& fileName)
 {
-    std::vector<std::string> result;
-    std::for_each(m_streams.begin(), m_streams.end(), [&result](auto it)
-    {
-        result.push_back(it.first);
-    });
-    return result;
+    #ifdef LINUX
+    auto entry = m_centralDirectory.find(fileName);
+    if ((m_descriptor == -1) || (entry == m_centralDirectory.end())) { return; }
+    // The extra field isn't known until the local file header is read, it is small enough to leave out.
+    // Of large files only the start is asked for, the file system's own read ahead takes it from there.
+    const std::uint64_t MaxReadAhead = 16 * 1024 * 1024;
+    auto offset = static_cast<off_t>(m_descriptorOffset + entry->second.localHeaderOffset);
+    auto size = static_cast<off_t>(std::min(LocalFileHeader::FixedSize() + fileName.size() + entry->second.compressedSize, MaxReadAhead));
+    posix_fadvise(m_descriptor, offset, size, POSIX_FADV_SEQUENTIAL);
+    posix_fadvise(m_descriptor, offset, size, POSIX_FADV_WILLNEED);
+    #endif
 }
 
 ComPtr<IStream> ZipObject::GetFile(const std::string& fileName)
-{   // TODO: Make this on-demand populate m_streams and then pull from there.
-    auto result = m_streams.find(fileName);
-    if (result == m_streams.end())
+{
+    {
+        std::lock_guard<std::mutex> lock(m_streamsLock);
+        auto result = m_streams.find(fileName);
+        if (result != m_streams.end())
+        {
+            return result->second;
+        }
+    }
+
+    auto entry = m_centralDirectory.find(fileName);
+    if (entry == m_centralDirectory.end())
     {
         return ComPtr<IStream>();
-    }        
-    return result->second;
+    }
+
+    // First time this file is requested, read its local file header and create the stream. Files can be asked
+    // for from different threads, so the header is read at its offset without moving m_stream's seek pointer,
+    // or under m_streamLock if the stream can't ReadAt.
+    const std::uint64_t maxHeaderSize = LocalFileHeader::FixedSize() + 2 * std::numeric_limits<std::uint16_t>::max();
+    auto headerStream = ComPtr<IStream>::Make<RangeStream>(entry->second.localHeaderOffset, maxHeaderSize, m_stream, m_streamLock);
+    LocalFileHeader localFileHeader(entry->second);
+    localFileHeader.Read(headerStream);
+
+    auto fileStream = ComPtr<IStream>::Make<ZipFileStream>(
+        fileName,
+        "TODO: Implement", // TODO: put value from content type
+        m_factory,
+        localFileHeader.GetCompressionType() == CompressionType::Deflate,
+        entry->second.localHeaderOffset + localFileHeader.Size(),
+        localFileHeader.GetCompressedSize(),
+        m_stream,
+        m_streamLock
+        );
+
+    if (localFileHeader.GetCompressionType() == CompressionType::Deflate)
+    {
+        fileStream = ComPtr<IStream>::Make<InflateStream>(std::move(fileStream), localFileHeader.GetUncompressedSize());
+    }
+
+    // Another thread may have got here first, everyone gets the stream that made it into the map.
+    std::lock_guard<std::mutex> lock(m_streamsLock);
+    return m_streams.insert(std::make_pair(fileName, fileStream)).first->second;
 }
 
 std::string ZipObject::GetFileName()
@@ -792,7 +1149,8 @@ ZipObject::ZipObject(IMsixFactory* appxFactory, const ComPtr<IStream>& stream) :
     EndCentralDirectoryRecord endCentralDirectoryRecord;
     LARGE_INTEGER pos = {0};
     pos.QuadPart = -1 * endCentralDirectoryRecord.Size();
-    ThrowHrIfFailed(m_stream->Seek(pos, StreamBase::Reference::END, nullptr));
+    ULARGE_INTEGER endOfCD = {0};
+    ThrowHrIfFailed(m_stream->Seek(pos, StreamBase::Reference::END, &endOfCD));
     endCentralDirectoryRecord.Read(m_stream.Get());
 
     // find where the zip central directory exists.
@@ -817,52 +1175,147 @@ ZipObject::ZipObject(IMsixFactory* appxFactory, const ComPtr<IStream>& stream) :
         zip64EndOfCentralDirectory.Read(m_stream.Get());            
         offsetStartOfCD = zip64EndOfCentralDirectory.GetOffsetStartOfCD();
         totalNumberOfEntries = zip64EndOfCentralDirectory.GetTotalNumberOfEntries();
+        endOfCD.QuadPart = zip64Locator.GetRelativeOffset();
     }
 
-    // read the zip central directory
-    std::map<std::string, std::shared_ptr<CentralDirectoryFileHeader>> centralDirectory;
+    // read the whole zip central directory with a single read and decode the headers from memory.
+    // Only a compact record of each entry is kept, local file headers are read and streams are
+    // created on demand by GetFile.
+    ThrowErrorIf(Error::ZipCentralDirectoryHeader, (offsetStartOfCD > endOfCD.QuadPart), "invalid offset of start of central directory");
+    ThrowErrorIf(Error::ZipCentralDirectoryHeader, ((endOfCD.QuadPart - offsetStartOfCD) > std::numeric_limits<ULONG>::max()),
+        "central directory too large");
+    std::vector<std::uint8_t> centralDirectory(static_cast<std::size_t>(endOfCD.QuadPart - offsetStartOfCD));
     pos.QuadPart = offsetStartOfCD;
     ThrowHrIfFailed(m_stream->Seek(pos, StreamBase::Reference::START, nullptr));
-    for (std::uint32_t index = 0; index < totalNumberOfEntries; index++)
-    {
-        auto centralFileHeader = std::make_shared<CentralDirectoryFileHeader>(endCentralDirectoryRecord.GetIsZip64());
-        centralFileHeader->Read(m_stream.Get());
-        // TODO: ensure that there are no collisions on name!
-        centralDirectory.insert(std::make_pair(centralFileHeader->GetFileName(), centralFileHeader));
+    StreamBase::Read(m_stream, centralDirectory);
+
+    DecodeCentralDirectory(centralDirectory, offsetStartOfCD, totalNumberOfEntries, endCentralDirectoryRecord, m_centralDirectory, m_fileNames);
+
+    ComPtr<IStreamBuffer> streamBuffer;
+    if (FAILED(m_stream->QueryInterface(UuidOfImpl<IStreamBuffer>::iid, reinterpret_cast<void**>(&streamBuffer))) ||
+        !streamBuffer->GetFileDescriptor(0, &m_descriptor, &m_descriptorOffset))
+    {   m_descriptor = -1;
     }
+} // ZipObject::ZipObject
 
-    if (endCentralDirectoryRecord.GetArchiveHasZip64Locator())
-    {   // We should have no data between the end of the last central directory header and the start of the EoCD
-        ULARGE_INTEGER uPos = {0};
-        ThrowHrIfFailed(m_stream->Seek({0}, StreamBase::Reference::CURRENT, &uPos));
-        ThrowErrorIfNot(Error::ZipHiddenData, (uPos.QuadPart == zip64Locator.GetRelativeOffset()), "hidden data unsupported");
-    }
-
-    // TODO: change population of m_streams into cache semantics and move into ZipObject::GetFile
-    // Read the file repository
-    for (const auto& centralFileHeader : centralDirectory)
-    {
-        pos.QuadPart = centralFileHeader.second->GetRelativeOffsetOfLocalHeader();
-        ThrowHrIfFailed(m_stream->Seek(pos, MSIX::StreamBase::Reference::START, nullptr));
-        auto localFileHeader = std::make_shared<LocalFileHeader>(centralFileHeader.second);
-        localFileHeader->Read(m_stream.Get());
-
-        auto fileStream = ComPtr<IStream>::Make<ZipFileStream>(
-            centralFileHeader.second->GetFileName(),
-            "TODO: Implement", // TODO: put value from content type 
-            m_factory,
-            localFileHeader->GetCompressionType() == CompressionType::Deflate,
-            centralFileHeader.second->GetRelativeOffsetOfLocalHeader() + localFileHeader->Size(),
-            localFileHeader->GetCompressedSize(),
-            m_stream
-            );
-
-        if (localFileHeader->GetCompressionType() == CompressionType::Deflate)
+ZipObject::ZipObject(IMsixFactory* appxFactory, const ComPtr<IStream>& stream, const FileVisitor& onFile) : m_factory(appxFactory), m_stream(stream)
+{
+    auto inflater = CreateCompressionObject();
+    auto source = ComPtr<ForwardOnlyStream>::Make<ForwardOnlyStream>(stream);
+    // Files that onFile read are gone, their streams can only tell their names and sizes.
+    auto consumed = ComPtr<IStream>::Make<StreamBase>();
+
+    auto NextSignature = [&source]()
+    {
+        ThrowErrorIf(Error::ZipEOCDRecord, (source->Fill(4) < 4), "zip is truncated");
+        return Meta::LoadLittleEndian<std::uint32_t>(source->Data());
+    };
+
+    while (NextSignature() == static_cast<std::uint32_t>(Signatures::LocalFileHeader))
+    {
+        ZipCentralDirectoryEntry entry;
+        entry.localHeaderOffset = source->Position();
+        LocalFileHeader localFileHeader(entry);
+        std::size_t available = source->Fill(LocalFileHeader::FixedSize());
+        if (available >= LocalFileHeader::FixedSize())
+        {   // The variable fields are at most 128KB, so the whole header fits in the buffer.
+            available = source->Fill(LocalFileHeader::FixedSize() + Meta::LoadLittleEndian<std::uint16_t>(source->Data() + 26) +
+                Meta::LoadLittleEndian<std::uint16_t>(source->Data() + 28));
+        }
+        source->Consume(localFileHeader.Read(source->Data(), available));
+        auto fileName = localFileHeader.GetFileName();
+        ThrowErrorIf(Error::ZipLocalFileHeader, (m_centralDirectory.find(fileName) != m_centralDirectory.end()), "duplicate file name");
+        bool isCompressed = (localFileHeader.GetCompressionType() == CompressionType::Deflate);
+
+        std::vector<std::uint8_t> kept;
+        bool isKept = false;
+        {
+            auto fileStream = ComPtr<ForwardOnlyFileStream>::Make<ForwardOnlyFileStream>(source.Get(), inflater.get(), localFileHeader);
+            isKept = !onFile(fileName, fileStream.As<IStream>());
+            if (isKept) { fileStream->Keep(&kept); }
+            fileStream->Finish();
+
+            entry.compressedSize = fileStream->GetCompressedSize();
+            entry.uncompressedSize = fileStream->GetUncompressedSize();
+            entry.isGeneralPurposeBitSet = localFileHeader.IsGeneralPurposeBitSet();
+        }
+
+        ComPtr<IStream> fileStream;
+        if (isKept)
         {
-            fileStream = ComPtr<IStream>::Make<InflateStream>(std::move(fileStream), localFileHeader->GetUncompressedSize());
+            auto& data = m_keptFiles[fileName];
+            data.swap(kept);
+            fileStream = ComPtr<IStream>::Make<ZipFileStream>(fileName, "TODO: Implement", m_factory, isCompressed, 0, data.size(),
+                ComPtr<IStream>::Make<VectorStream>(&data));
         }
+        else
+        {
+            fileStream = ComPtr<IStream>::Make<ZipFileStream>(fileName, "TODO: Implement", m_factory, isCompressed, 0, entry.compressedSize, consumed);
+        }
+        if (isCompressed)
+        {   fileStream = ComPtr<IStream>::Make<InflateStream>(std::move(fileStream), entry.uncompressedSize);
+        }
+        m_streams.insert(std::make_pair(fileName, fileStream));
+        m_centralDirectory.insert(std::make_pair(fileName, entry));
+    }
+
+    // The central directory, collected header by header as only the headers say how long they are.
+    std::uint64_t offsetStartOfCD = source->Position();
+    std::vector<std::uint8_t> centralDirectory;
+    while (NextSignature() == static_cast<std::uint32_t>(Signatures::CentralFileHeader))
+    {
+        std::size_t available = source->Fill(CentralDirectoryFileHeader::FixedSize());
+        ThrowErrorIf(Error::ZipCentralDirectoryHeader, (available < CentralDirectoryFileHeader::FixedSize()), "central directory header truncated");
+        std::size_t size = CentralDirectoryFileHeader::FixedSize() + Meta::LoadLittleEndian<std::uint16_t>(source->Data() + 28) +
+            Meta::LoadLittleEndian<std::uint16_t>(source->Data() + 30) + Meta::LoadLittleEndian<std::uint16_t>(source->Data() + 32);
+        ThrowErrorIf(Error::ZipCentralDirectoryHeader, (source->Fill(size) < size), "central directory header truncated");
+        centralDirectory.insert(centralDirectory.end(), source->Data(), source->Data() + size);
+        source->Consume(size);
+    }
 
-        m_streams.insert(std::make_pair(centralFileHeader.second->GetFileName(), std::move(fileStream)));
+    std::uint64_t totalNumberOfEntries = 0;
+    std::uint64_t endOfCD = source->Position();
+    bool hasZip64EndOfCD = (NextSignature() == static_cast<std::uint32_t>(Signatures::Zip64EndOfCD));
+    if (hasZip64EndOfCD)
+    {
+        Zip64EndOfCentralDirectoryRecord zip64EndOfCentralDirectory;
+        zip64EndOfCentralDirectory.Read(source.As<IStream>());
+        Zip64EndOfCentralDirectoryLocator zip64Locator;
+        zip64Locator.Read(source.As<IStream>());
+        ThrowErrorIf(Error::Zip64EOCDLocator, (zip64Locator.GetRelativeOffset() != endOfCD), "Invalid relative offset");
+        ThrowErrorIf(Error::Zip64EOCDRecord, (zip64EndOfCentralDirectory.GetOffsetStartOfCD() != offsetStartOfCD), "invalid offset of start of central directory");
+        ThrowErrorIf(Error::Zip64EOCDRecord, (zip64EndOfCentralDirectory.GetSizeOfCD() != centralDirectory.size()), "invalid size of central directory");
+        totalNumberOfEntries = zip64EndOfCentralDirectory.GetTotalNumberOfEntries();
+    }
+    EndCentralDirectoryRecord endCentralDirectoryRecord;
+    endCentralDirectoryRecord.Read(source.As<IStream>());
+    ThrowErrorIf(Error::ZipHiddenData, (source->Fill(1) != 0), "hidden data unsupported");
+    if (!endCentralDirectoryRecord.GetArchiveHasZip64Locator())
+    {
+        ThrowErrorIf(Error::ZipEOCDRecord, hasZip64EndOfCD, "unexpected zip64 end of central directory record");
+        ThrowErrorIf(Error::ZipEOCDRecord, (endCentralDirectoryRecord.GetStartOfCentralDirectory() != offsetStartOfCD),
+            "invalid offset of start of central directory");
+        totalNumberOfEntries = endCentralDirectoryRecord.GetNumberOfCentralDirectoryEntries();
+    }
+    else
+    {   ThrowErrorIfNot(Error::ZipEOCDRecord, hasZip64EndOfCD, "missing zip64 end of central directory record");
+    }
+
+    // Every file of the central directory must be the one that was read.
+    std::map<std::string, ZipCentralDirectoryEntry> centralDirectoryEntries;
+    DecodeCentralDirectory(centralDirectory, offsetStartOfCD, totalNumberOfEntries, endCentralDirectoryRecord, centralDirectoryEntries, m_fileNames);
+    ThrowErrorIf(Error::ZipCentralDirectoryHeader, ((totalNumberOfEntries != m_centralDirectory.size()) ||
+        (centralDirectoryEntries.size() != m_centralDirectory.size())), "central directory doesn't match local file headers");
+    for (const auto& centralEntry : centralDirectoryEntries)
+    {
+        auto localEntry = m_centralDirectory.find(centralEntry.first);
+        ThrowErrorIf(Error::ZipCentralDirectoryHeader, (localEntry == m_centralDirectory.end()), "central directory doesn't match local file headers");
+        ThrowErrorIf(Error::ZipCentralDirectoryHeader, (
+            (localEntry->second.localHeaderOffset != centralEntry.second.localHeaderOffset) ||
+            (localEntry->second.compressedSize != centralEntry.second.compressedSize) ||
+            (localEntry->second.uncompressedSize != centralEntry.second.uncompressedSize) ||
+            (localEntry->second.isGeneralPurposeBitSet != centralEntry.second.isGeneralPurposeBitSet)),
+            "central directory doesn't match local file headers");
     }
 } // ZipObject::ZipObject
-} // namespace MSIX
\ No newline at end of file
+} // namespace MSIX
\ No newline at end of file
@@ -5,6 +5,9 @@
 #include "Exceptions.hpp"
 #include "StreamBase.hpp"
 #include "FileStream.hpp"
+#ifdef LINUX
+#include "MappedFileStream.hpp"
+#endif
 #include "RangeStream.hpp"
 #include "ZipObject.hpp"
 #include "DirectoryObject.hpp"
@@ -62,10 +65,20 @@ MSIX_API HRESULT STDMETHODCALLTYPE UnpackPackage(
     MSIX::ComPtr<IStream> stream;
     ThrowHrIfFailed(CreateStreamOnFile(utf8SourcePackage, true, &stream));
 
+    // Only when asked for, e.g. for pipes. The package is read front to back in one pass as it arrives.
+    if (packUnpackOptions & MSIX_PACKUNPACK_OPTION_READFORWARDONLY)
+    {
+        auto to = MSIX::ComPtr<MSIX::DirectoryObject>::Make<MSIX::DirectoryObject>(utf8Destination,
+            (packUnpackOptions & MSIX_PACKUNPACK_OPTION_UNBUFFEREDWRITES) != 0);
+        MSIX::AppxPackageObject::UnpackFromStream(factory.As<IMsixFactory>().Get(), validationOption, packUnpackOptions, stream, to);
+        return static_cast<HRESULT>(MSIX::Error::OK);
+    }
+
     MSIX::ComPtr<IAppxPackageReader> reader;
     ThrowHrIfFailed(factory->CreatePackageReader(stream.Get(), &reader));
 
-    auto to = MSIX::ComPtr<IStorageObject>::Make<MSIX::DirectoryObject>(utf8Destination);
+    auto to = MSIX::ComPtr<IStorageObject>::Make<MSIX::DirectoryObject>(utf8Destination,
+        (packUnpackOptions & MSIX_PACKUNPACK_OPTION_UNBUFFEREDWRITES) != 0);
     reader.As<IPackage>()->Unpack(packUnpackOptions, to.Get());
     return static_cast<HRESULT>(MSIX::Error::OK);
 } CATCH_RETURN();
@@ -86,10 +99,20 @@ MSIX_API HRESULT STDMETHODCALLTYPE UnpackPackageFromStream(
     // out to the caller.  So default to new / delete[] and be done with it!
     ThrowHrIfFailed(CoCreateAppxFactoryWithHeap(InternalAllocate, InternalFree, validationOption, &factory));
 
+    // Only when asked for, e.g. for pipes. The package is read front to back in one pass as it arrives.
+    if (packUnpackOptions & MSIX_PACKUNPACK_OPTION_READFORWARDONLY)
+    {
+        auto to = MSIX::ComPtr<MSIX::DirectoryObject>::Make<MSIX::DirectoryObject>(utf8Destination,
+            (packUnpackOptions & MSIX_PACKUNPACK_OPTION_UNBUFFEREDWRITES) != 0);
+        MSIX::AppxPackageObject::UnpackFromStream(factory.As<IMsixFactory>().Get(), validationOption, packUnpackOptions, stream, to);
+        return static_cast<HRESULT>(MSIX::Error::OK);
+    }
+
     MSIX::ComPtr<IAppxPackageReader> reader;
     ThrowHrIfFailed(factory->CreatePackageReader(stream, &reader));
 
-    auto to = MSIX::ComPtr<IStorageObject>::Make<MSIX::DirectoryObject>(utf8Destination);
+    auto to = MSIX::ComPtr<IStorageObject>::Make<MSIX::DirectoryObject>(utf8Destination,
+        (packUnpackOptions & MSIX_PACKUNPACK_OPTION_UNBUFFEREDWRITES) != 0);
     reader.As<IPackage>()->Unpack(packUnpackOptions, to.Get());
     return static_cast<HRESULT>(MSIX::Error::OK);
 } CATCH_RETURN();
@@ -118,7 +141,8 @@ MSIX_API HRESULT STDMETHODCALLTYPE UnpackBundle(
     MSIX::ComPtr<IAppxBundleReader> reader;
     ThrowHrIfFailed(factory->CreateBundleReader(stream.Get(), &reader));
 
-    auto to = MSIX::ComPtr<IStorageObject>::Make<MSIX::DirectoryObject>(utf8Destination);
+    auto to = MSIX::ComPtr<IStorageObject>::Make<MSIX::DirectoryObject>(utf8Destination,
+        (packUnpackOptions & MSIX_PACKUNPACK_OPTION_UNBUFFEREDWRITES) != 0);
     reader.As<IPackage>()->Unpack(packUnpackOptions, to.Get());
     return static_cast<HRESULT>(MSIX::Error::OK);
 #else
@@ -147,7 +171,8 @@ MSIX_API HRESULT STDMETHODCALLTYPE UnpackBundleFromStream(
     MSIX::ComPtr<IAppxBundleReader> reader;
     ThrowHrIfFailed(factory->CreateBundleReader(stream, &reader));
 
-    auto to = MSIX::ComPtr<IStorageObject>::Make<MSIX::DirectoryObject>(utf8Destination);
+    auto to = MSIX::ComPtr<IStorageObject>::Make<MSIX::DirectoryObject>(utf8Destination,
+        (packUnpackOptions & MSIX_PACKUNPACK_OPTION_UNBUFFEREDWRITES) != 0);
     reader.As<IPackage>()->Unpack(packUnpackOptions, to.Get());
     return static_cast<HRESULT>(MSIX::Error::OK);
 #else
@@ -158,12 +183,14 @@ MSIX_API HRESULT STDMETHODCALLTYPE UnpackBundleFromStream(
 MSIX_API HRESULT STDMETHODCALLTYPE GetLogTextUTF8(COTASKMEMALLOC* memalloc, char** logText) noexcept try
 {
     ThrowErrorIf(MSIX::Error::InvalidParameter, (logText == nullptr || *logText != nullptr), "bad pointer" );
-    std::size_t countBytes = sizeof(char)*(MSIX::Global::Log::Text().size()+1);
+    // Other threads may log meanwhile, so the text is only taken once.
+    auto text = MSIX::Global::Log::Text();
+    std::size_t countBytes = sizeof(char)*(text.size()+1);
     *logText = reinterpret_cast<char*>(memalloc(countBytes));
     ThrowErrorIfNot(MSIX::Error::OutOfMemory, (*logText), "Allocation failed!");
     std::memset(reinterpret_cast<void*>(*logText), 0, countBytes);
     std::memcpy(reinterpret_cast<void*>(*logText),
-                reinterpret_cast<void*>(const_cast<char*>(MSIX::Global::Log::Text().c_str())),
+                reinterpret_cast<void*>(const_cast<char*>(text.c_str())),
                 countBytes - sizeof(char));
     MSIX::Global::Log::Clear();
     return static_cast<HRESULT>(MSIX::Error::OK);
@@ -174,6 +201,17 @@ MSIX_API HRESULT STDMETHODCALLTYPE CreateStreamOnFile(
     bool forRead,
     IStream** stream) noexcept try
 {
+    #ifdef LINUX
+    if (forRead)
+    {
+        auto mapped = MSIX::MappedFileStream::Open(utf8File);
+        if (mapped)
+        {
+            *stream = mapped.Detach();
+            return static_cast<HRESULT>(MSIX::Error::OK);
+        }
+    }
+    #endif
     MSIX::FileStream::Mode mode = forRead ? MSIX::FileStream::Mode::READ : MSIX::FileStream::Mode::WRITE_UPDATE;
     *stream = MSIX::ComPtr<IStream>::Make<MSIX::FileStream>(utf8File, mode).Detach();
     return static_cast<HRESULT>(MSIX::Error::OK);
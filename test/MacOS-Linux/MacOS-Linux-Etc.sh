@@ -65,6 +65,45 @@ function RunTest {
     fi
 }
 
+# Unpacks the package read from a pipe, which only works front to back.
+function RunPipedTest {
+    CleanupUnpackFolder
+    local SUCCESS="$1"
+    local PACKAGE="$2"
+    local ARGS="$3"
+    echo "------------------------------------------------------"
+    echo cat $PACKAGE "|" $BINDIR/makemsix unpack -d ./../unpack -p /dev/stdin -fo $ARGS
+    echo "------------------------------------------------------"
+    cat $PACKAGE | $BINDIR/makemsix unpack -d ./../unpack -p /dev/stdin -fo $ARGS
+    local RESULT=$?
+    echo "expect: "$SUCCESS", got: "$RESULT
+    if [ $RESULT -eq $SUCCESS ]
+    then
+        echo "succeeded"
+    else
+        echo "FAILED"
+        TESTFAILED=1
+    fi
+}
+
+function ValidateSerialResult {
+    local PACKAGE="$1"
+    local ARGS="$2"
+    echo "Validating extracted files with a serial unpack of "$PACKAGE
+    rm -f -r ./../unpackserial
+    $BINDIR/makemsix unpack -d ./../unpackserial -p $PACKAGE $ARGS > /dev/null
+    diff -r ./../unpack ./../unpackserial
+    diff_result=$?
+    if [ $diff_result -ne 0 ]
+    then
+        echo "FAILED comparing extracted files"
+        TESTFAILED=1
+    else
+        echo "succeeded comparing extracted files"
+    fi
+    rm -f -r ./../unpackserial
+}
+
 FindBinFolder
 # return code is last two digits, but in decimal, not hex.  e.g. 0x8bad0002 == 2, 0x8bad0041 == 65, etc...
 # common codes:
@@ -82,7 +121,7 @@ RunTest 66 ./../appx/SignedTamperedContentTypes-TRUST_E_BAD_DIGEST.appx
 RunTest 66 ./../appx/SignedUntrustedCert-CERT_E_CHAINING.appx
 RunTest 0 ./../appx/TestAppxPackage_Win32.appx -ss
 RunTest 0 ./../appx/TestAppxPackage_x64.appx -ss
-RunTest 18 ./../appx/UnsignedZip64WithCI-APPX_E_MISSING_REQUIRED_FILE.appx
+RunTest 49 ./../appx/UnsignedZip64WithCI-APPX_E_MISSING_REQUIRED_FILE.appx
 RunTest 1 ./../appx/FileDoesNotExist.appx -ss
 RunTest 81 ./../appx/BlockMap/Missing_Manifest_in_blockmap.appx -ss
 RunTest 81 ./../appx/BlockMap/ContentTypes_in_blockmap.appx -ss
@@ -95,6 +134,27 @@ RunTest 51 ./../appx/BlockMap/No_blockmap.appx -ss
 RunTest 3 ./../appx/BlockMap/Bad_Namespace_Blockmap.appx -ss
 RunTest 81 ./../appx/BlockMap/Duplicate_file_in_blockmap.appx -ss
 
+# Forward only tests
+RunPipedTest 0 ./../appx/HelloWorld.appx -ss
+ValidateSerialResult ./../appx/HelloWorld.appx -ss
+RunPipedTest 0 ./../appx/NotepadPlusPlus.appx -ss
+ValidateSerialResult ./../appx/NotepadPlusPlus.appx -ss
+RunPipedTest 65 ./../appx/SignedTamperedBlockMap-TRUST_E_BAD_DIGEST.appx -sv
+
+# Parallel unpack tests
+RunTest 0 ./../appx/HelloWorld.appx "-ss -mt"
+ValidateSerialResult ./../appx/HelloWorld.appx -ss
+RunTest 0 ./../appx/NotepadPlusPlus.appx "-ss -mt"
+ValidateSerialResult ./../appx/NotepadPlusPlus.appx -ss
+RunTest 66 ./../appx/SignedTamperedBlockMap-TRUST_E_BAD_DIGEST.appx -mt
+RunTest 65 ./../appx/SignedTamperedBlockMap-TRUST_E_BAD_DIGEST.appx "-sv -mt"
+
+# Unbuffered write tests
+RunTest 0 ./../appx/HelloWorld.appx "-ss -dio"
+ValidateSerialResult ./../appx/HelloWorld.appx -ss
+RunTest 0 ./../appx/NotepadPlusPlus.appx "-ss -mt -dio"
+ValidateSerialResult ./../appx/NotepadPlusPlus.appx -ss
+
 RunTest 0  ./../appx/StoreSigned_Desktop_x64_MoviesTV.appx
 ValidateResult ExpectedResult/$directory/StoreSigned_Desktop_x64_MoviesTV.txt
 
@@ -83,6 +83,30 @@ function RunTest([int] $SUCCESSCODE, [string] $PACKAGE, [string] $OPT) {
     }
 }
 
+function GetExtractedFiles([string] $ROOT) {
+    $rootPath = (Resolve-Path $ROOT).Path
+    Get-ChildItem $ROOT -file -recurse | ForEach-Object { "$($_.FullName.Substring($rootPath.Length)) $((Get-FileHash $_.FullName).Hash)" }
+}
+
+function ValidateSerialResult([string] $PACKAGE, [string] $OPT) {
+    write-host "Validating extracted files with a serial unpack of $PACKAGE"
+    if (Test-Path ".\..\unpackserial")
+    {
+        Remove-Item ".\..\unpackserial" -recurse
+    }
+    $p = Start-Process $BINDIR\makemsix.exe -ArgumentList "unpack -d .\..\unpackserial -p $PACKAGE $OPT" -wait -NoNewWindow -PassThru
+    if(($p.ExitCode -ne 0) -or (Compare-Object -ReferenceObject @(GetExtractedFiles ".\..\unpack") -DifferenceObject @(GetExtractedFiles ".\..\unpackserial")))
+    {
+        write-host  "FAILED comparing extracted files"
+        $global:TESTFAILED=1
+    }
+    else
+    {
+        write-host  "succeeded comparing extracted files"
+    }
+    Remove-Item ".\..\unpackserial" -recurse
+}
+
 FindBinFolder
 
 # Normal package
@@ -99,7 +123,7 @@ RunTest 0x8bad0042 .\..\appx\SignedTamperedContentTypes-TRUST_E_BAD_DIGEST.appx
 RunTest 0x8bad0042 .\..\appx\SignedUntrustedCert-CERT_E_CHAINING.appx
 RunTest 0x00000000 .\..\appx\TestAppxPackage_Win32.appx "-ss"
 RunTest 0x00000000 .\..\appx\TestAppxPackage_x64.appx "-ss"
-RunTest 0x8bad0012 .\..\appx\UnsignedZip64WithCI-APPX_E_MISSING_REQUIRED_FILE.appx
+RunTest 0x8bad0031 .\..\appx\UnsignedZip64WithCI-APPX_E_MISSING_REQUIRED_FILE.appx
 RunTest 0x8bad0001 .\..\appx\FileDoesNotExist.appx "-ss"
 RunTest 0x8bad0051 .\..\appx\BlockMap\Missing_Manifest_in_blockmap.appx "-ss"
 RunTest 0x8bad0051 .\..\appx\BlockMap\ContentTypes_in_blockmap.appx "-ss"
@@ -112,6 +136,27 @@ RunTest 0x8bad0033 .\..\appx\BlockMap\No_blockmap.appx "-ss"
 RunTest 0x8bad1003 .\..\appx\BlockMap\Bad_Namespace_Blockmap.appx "-ss"
 RunTest 0x8bad0051 .\..\appx\BlockMap\Duplicate_file_in_blockmap.appx "-ss"
 
+# Forward only tests. The package can't be piped to makemsix here, but -fo reads it front to back all the same.
+RunTest 0x00000000 .\..\appx\HelloWorld.appx "-fo -ss"
+ValidateSerialResult .\..\appx\HelloWorld.appx "-ss"
+RunTest 0x00000000 .\..\appx\NotepadPlusPlus.appx "-fo -ss"
+ValidateSerialResult .\..\appx\NotepadPlusPlus.appx "-ss"
+RunTest 0x8bad0041 .\..\appx\SignedTamperedBlockMap-TRUST_E_BAD_DIGEST.appx "-fo -sv"
+
+# Parallel unpack tests
+RunTest 0x00000000 .\..\appx\HelloWorld.appx "-ss -mt"
+ValidateSerialResult .\..\appx\HelloWorld.appx "-ss"
+RunTest 0x00000000 .\..\appx\NotepadPlusPlus.appx "-ss -mt"
+ValidateSerialResult .\..\appx\NotepadPlusPlus.appx "-ss"
+RunTest 0x8bad0042 .\..\appx\SignedTamperedBlockMap-TRUST_E_BAD_DIGEST.appx "-mt"
+RunTest 0x8bad0041 .\..\appx\SignedTamperedBlockMap-TRUST_E_BAD_DIGEST.appx "-sv -mt"
+
+# Unbuffered write tests
+RunTest 0x00000000 .\..\appx\HelloWorld.appx "-ss -dio"
+ValidateSerialResult .\..\appx\HelloWorld.appx "-ss"
+RunTest 0x00000000 .\..\appx\NotepadPlusPlus.appx "-ss -mt -dio"
+ValidateSerialResult .\..\appx\NotepadPlusPlus.appx "-ss"
+
 RunTest 0x00000000 .\..\appx\StoreSigned_Desktop_x64_MoviesTV.appx
 ValidateResult ExpectedResults\StoreSigned_Desktop_x64_MoviesTV.txt
 
@@ -452,6 +452,76 @@ void TestBundle()
     return;
 }
 
+// Runs on the threads of TestThreads, where the VERIFY macros can't be used. An exception thrown there would end
+// the process.
+HRESULT CountPayloadFiles(IAppxFactory* factory, int* count)
+{
+    ComPtr<IStream> inputStream;
+    HRESULT hr = CreateStreamOnFile(const_cast<char*>(packageToTest), true, &inputStream);
+    ComPtr<IAppxPackageReader> packageReader;
+    if (SUCCEEDED(hr)) { hr = factory->CreatePackageReader(inputStream.Get(), &packageReader); }
+    ComPtr<IAppxManifestReader> manifestReader;
+    if (SUCCEEDED(hr)) { hr = packageReader->GetManifest(&manifestReader); }
+    ComPtr<IAppxFilesEnumerator> files;
+    if (SUCCEEDED(hr)) { hr = packageReader->GetPayloadFiles(&files); }
+    BOOL hasCurrent = FALSE;
+    if (SUCCEEDED(hr)) { hr = files->GetHasCurrent(&hasCurrent); }
+    while (SUCCEEDED(hr) && hasCurrent)
+    {
+        (*count)++;
+        hr = files->MoveNext(&hasCurrent);
+    }
+    return hr;
+}
+
+void TestThreads()
+{
+    const int nThreads = 8;
+    std::vector<HRESULT> results(nThreads);
+    std::vector<std::thread> threads;
+
+    // Unpack the package on every thread at once, each into its own folder
+    for (int i = 0; i < nThreads; i++)
+    {
+        threads.emplace_back([&results, i]()
+        {
+            std::string unpackFolder = unpackFolderToTest + std::to_string(i);
+            results[i] = UnpackPackage(
+                MSIX_PACKUNPACK_OPTION::MSIX_PACKUNPACK_OPTION_NONE,
+                MSIX_VALIDATION_OPTION::MSIX_VALIDATION_OPTION_SKIPSIGNATURE,
+                const_cast<char*>(packageToTest),
+                const_cast<char*>(unpackFolder.c_str()));
+        });
+    }
+    for (auto& thread : threads) { thread.join(); }
+    for (auto result : results) { VERIFY_SUCCEEDED(result); }
+
+    // Read the package on every thread through one factory
+    ComPtr<IAppxFactory> factory;
+    VERIFY_SUCCEEDED(CoCreateAppxFactoryWithHeap(
+        MyAllocate,
+        MyFree,
+        MSIX_VALIDATION_OPTION::MSIX_VALIDATION_OPTION_SKIPSIGNATURE,
+        &factory));
+
+    std::vector<int> nFiles(nThreads, 0);
+    threads.clear();
+    for (int i = 0; i < nThreads; i++)
+    {
+        threads.emplace_back([&factory, &results, &nFiles, i]()
+        {
+            results[i] = CountPayloadFiles(factory.Get(), &nFiles[i]);
+        });
+    }
+    for (auto& thread : threads) { thread.join(); }
+    for (int i = 0; i < nThreads; i++)
+    {
+        VERIFY_SUCCEEDED(results[i]);
+        VERIFY_ARE_EQUAL(nFiles[i], ExpectedPayloadFilesSize);
+    }
+
+    return;
+}
 
 int main(int argc, char* argv[])
 {
@@ -459,6 +529,7 @@ int main(int argc, char* argv[])
     {
         TestPackage();
         TestBundle();
+        TestThreads();
         std::cout << "Test PASSED" << std::endl;
     }
     catch (Exception e)
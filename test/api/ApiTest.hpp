@@ -12,6 +12,8 @@
 #include <codecvt>
 #include <string>
 #include <locale>
+#include <thread>
+#include <vector>
 
 class Exception : public std::exception
 {
@@ -12,6 +12,13 @@ static const char* packageToTest = "..\\test\\appx\\TestAppxPackage_Win32.appx";
 static const char* packageToTest = "../test/appx/TestAppxPackage_Win32.appx";
 #endif
 
+// Each thread of the thread test unpacks into this folder with its number appended
+#ifdef WIN32
+static const char* unpackFolderToTest = "..\\test\\unpack\\apitest";
+#else
+static const char* unpackFolderToTest = "../test/unpack/apitest";
+#endif
+
 #if defined(USING_MSXML) 
 static const wchar_t* ApplicationXpath = L"/*[local-name()='Package']/*[local-name()='Applications']/*[local-name()='Application']";
 #else